@@ -6,6 +6,7 @@
 #include <cstdint>
 #include <unistd.h>
 #include <map>
+#include <limits>
 
 // `KEY_TYPE` and `VAL_TYPE` are the key and value types inserted into
 // the tree. The dictionary used in DICT encoding will map values of
@@ -30,24 +31,210 @@ enum TestingSwitch {
 
 const TestingSwitch TESTING_SWITCH = TESTING_ON;
 
+// The encoding, filter, fence index, and merge policy are compile-time policies of the tree (see
+// `Policy` below), so the accessors on the hot path compile down to plain array loads with no
+// branching on the configuration. Each can be overridden from the compiler command line, e.g.
+// `-DLSM_ENCODING=ENCODING_DICT`, which is how `make policies` builds one server per combination.
+// ENCODING_VLOG separates the values from the keys (as in WiscKey): values are appended once to a value
+// log and the runs store 8-byte pointers to them, so merges move pointers instead of values.
 enum EncodingType {
     ENCODING_OFF,
     ENCODING_DICT,
+    ENCODING_VLOG,
 };
 
-const EncodingType ENCODING_TYPE = ENCODING_OFF;
+// FILTER_NONE drops the per-run bloom and range filters, trading extra page reads on gets and
+// ranges for memory. FILTER_CUCKOO replaces the per-run bloom filters with one `LevelFilter` for the
+// whole tree, which a get probes once to learn which levels may hold its key; the runs keep their
+// range filters.
+enum FilterType {
+    FILTER_BLOOM,
+    FILTER_NONE,
+    FILTER_CUCKOO,
+};
+
+// INDEX_FENCE keeps the first key of every page of a run in memory. INDEX_BINARY_SEARCH keeps nothing
+// and binary searches the first keys of the pages in the mmap'd key file instead.
+enum IndexType {
+    INDEX_FENCE,
+    INDEX_BINARY_SEARCH,
+};
+
+// MERGE_ROUND_ROBIN compacts the runs of a full level in key order. MERGE_MIN_OVERLAP compacts the
+// run overlapping the fewest pairs in the next level, which rewrites the least data per merge.
+enum MergePolicy {
+    MERGE_ROUND_ROBIN,
+    MERGE_MIN_OVERLAP,
+};
+
+#ifndef LSM_ENCODING
+#define LSM_ENCODING ENCODING_OFF
+#endif
+#ifndef LSM_FILTER
+#define LSM_FILTER FILTER_BLOOM
+#endif
+#ifndef LSM_INDEX
+#define LSM_INDEX INDEX_FENCE
+#endif
+#ifndef LSM_MERGE
+#define LSM_MERGE MERGE_ROUND_ROBIN
+#endif
+
+const EncodingType ENCODING_TYPE = LSM_ENCODING;
+const FilterType FILTER_TYPE = LSM_FILTER;
+const IndexType INDEX_TYPE = LSM_INDEX;
+const MergePolicy MERGE_POLICY = LSM_MERGE;
+
+// `Policy`
+// The compile-time policies of an LSM tree, passed as its last template parameter. Defaults to the
+// configuration above.
+template<EncodingType Encoding = ENCODING_TYPE, FilterType Filter = FILTER_TYPE, IndexType Index = INDEX_TYPE, MergePolicy Merge = MERGE_POLICY>
+struct Policy {
+    static constexpr EncodingType encoding = Encoding;
+    static constexpr FilterType filter = Filter;
+    static constexpr IndexType index = Index;
+    static constexpr MergePolicy merge = Merge;
+};
 
 // We set PAGE_SIZE to this since int64_t is the largest type supported.
 const size_t PAGE_SIZE = sysconf(_SC_PAGESIZE) / sizeof(int64_t);
 const size_t BUFFER_PAGES = 4;
 const size_t SIZE_RATIO = 10;
 const float BLOOM_TARGET_FPR = 0.01;
+// The knobs above are only the defaults for a new database: they can be changed at runtime with the
+// `k` command and are persisted in the catalog. With BLOOM_MONKEY, BLOOM_TARGET_FPR is the average
+// false positive rate and deeper levels get proportionally higher rates for the same memory.
+enum BloomAllocation {
+    BLOOM_UNIFORM,
+    BLOOM_MONKEY,
+};
+
+const BloomAllocation BLOOM_ALLOCATION = BLOOM_UNIFORM;
+
+// Every TUNER_INTERVAL buffer flushes, the tuner updates its estimate of the read, write, and range
+// mix (weighting the previous estimate by TUNER_DECAY) and searches for the size ratio, buffer size,
+// and bloom filter allocation with the lowest modeled cost for the same memory. TUNER_RECOMMEND only
+// reports the result, while TUNER_APPLY moves the knobs one step towards it each time.
+enum TunerMode {
+    TUNER_OFF,
+    TUNER_RECOMMEND,
+    TUNER_APPLY,
+};
+
+const TunerMode TUNER_MODE = TUNER_OFF;
+const size_t TUNER_INTERVAL = 64;
+const double TUNER_DECAY = 0.5;
+const size_t TUNER_MAX_SIZE_RATIO = 16;
+const size_t TUNER_MAX_BUFFER_PAGES = 256;
+
+// Levels beneath the buffer are split into key-disjoint runs of at most FILE_PAGES pages each, and
+// a merge only rewrites the runs that overlap the data coming down.
+const size_t FILE_PAGES = BUFFER_PAGES;
+
+// With DYNAMIC_LEVEL_SIZING the capacities of the levels above the last are worked back from the size
+// of the last level, each SIZE_RATIO times smaller than the one beneath it, as in RocksDB's dynamic
+// level bytes. The upper levels then hold about 1 / (SIZE_RATIO - 1) of the data whatever its size.
+// The last level has no capacity: once it outgrows the bufferSize * SIZE_RATIO^l entries of a fixed
+// level l, an empty level is inserted beneath the buffer and the others move down one. Without it,
+// level l holds bufferSize * SIZE_RATIO^l entries and a full last level spills into a new level.
+const bool DYNAMIC_LEVEL_SIZING = true;
+
+// Merges rewriting at least SUBCOMPACTION_MIN_PAIRS pairs are split into key-range subcompactions that
+// run in parallel on COMPACTION_THREADS workers (0 means one per hardware thread).
+const size_t COMPACTION_THREADS = 0;
+const size_t SUBCOMPACTION_MIN_PAIRS = 1 << 16;
+
+// After a flush, full levels are compacted shallowest first in priority lanes: the flush into level 1
+// always runs, then merges out of level 1, then deeper merges. With a COMPACTION_RATE (bytes of merge
+// reads and writes per second, 0 for no limit), `CompactionLimiter` paces the lanes beneath the flush,
+// and a level it leaves full waits for a later flush until it reaches COMPACTION_STALL_RATIO times its
+// capacity, when it is compacted regardless. COMPACTION_PAUSE_TARGET_NS (0 for a fixed rate) is the
+// p99 pause for a flushing write that the rate tunes itself towards. Each shard paces itself.
+enum CompactionLane {
+    COMPACTION_FLUSH,
+    COMPACTION_L1,
+    COMPACTION_DEEP,
+};
+
+const double COMPACTION_RATE = 0;
+const double COMPACTION_RATE_MIN = 1 << 20;
+const double COMPACTION_RATE_MAX = 1ull << 32;
+const size_t COMPACTION_BURST_BYTES = 8 << 20;
+const double COMPACTION_DEEP_RESERVE = 0.5;
+const double COMPACTION_STALL_RATIO = 2;
+const double COMPACTION_PAUSE_TARGET_NS = 0;
+const size_t COMPACTION_TUNE_WINDOW = 128;
+
+// A level (other than the buffer and the last level) is merged into the next level early if more than
+// TOMBSTONE_COMPACTION_RATIO of its entries are tombstones, or if it has held tombstones for more than
+// TOMBSTONE_MAX_AGE buffer flushes. This pushes deletes to the last level, where they are dropped.
+const float TOMBSTONE_COMPACTION_RATIO = 0.3;
+const size_t TOMBSTONE_MAX_AGE = 1000;
+
+// The key space is split across NUM_SHARDS independent trees (0 means one per hardware thread), each
+// with its own buffer, data subfolder, and worker thread pinned to a core. SHARD_BY_RANGE splits
+// [SHARD_KEY_MIN, SHARD_KEY_MAX] into equal slices so that ranges only visit the overlapping shards,
+// while SHARD_BY_HASH spreads skewed key spaces evenly but sends every range to all shards.
+enum ShardingType {
+    SHARD_BY_RANGE,
+    SHARD_BY_HASH,
+};
+
+const size_t NUM_SHARDS = 1;
+const ShardingType SHARDING_TYPE = SHARD_BY_RANGE;
+const KEY_TYPE SHARD_KEY_MIN = std::numeric_limits<KEY_TYPE>::min();
+const KEY_TYPE SHARD_KEY_MAX = std::numeric_limits<KEY_TYPE>::max();
+const uint32_t SHARD_HASH_SEED = 0x9747b28c;
+
+// Keys and values may also be byte strings (`std::string`). String keys are prefix compressed in
+// blocks of KEY_RESTART_INTERVAL keys, and the heap files holding strings start out with room for
+// STRING_HEAP_BYTES_PER_ENTRY bytes per entry and grow as needed. DICT encoding needs fixed-width values.
+const size_t KEY_RESTART_INTERVAL = 16;
+const size_t STRING_HEAP_BYTES_PER_ENTRY = 16;
+
+// With ENCODING_VLOG the value log is split into segments of VLOG_SEGMENT_BYTES. After each buffer
+// flush, the sealed segment with the largest fraction of dead records (values whose pointers merges
+// have dropped) is garbage collected if that fraction is at least VLOG_GC_RATIO: its live values are
+// copied to the head of the log and the segment is deleted.
+const size_t VLOG_SEGMENT_BYTES = 16 << 20;
+const double VLOG_GC_RATIO = 0.5;
+
+// Unless the filter is FILTER_NONE, each run also has a range filter, see `RangeFilter`. It holds the
+// prefixes of the keys at RANGE_FILTER_LEVELS granularities, each RANGE_FILTER_STRIDE bits coarser
+// than the last, in RANGE_FILTER_BITS_PER_PREFIX bits per key and level. A range gives up on the
+// filter of a run after RANGE_FILTER_MAX_PROBES probes and searches the run.
+const size_t RANGE_FILTER_LEVELS = 4;
+const size_t RANGE_FILTER_STRIDE = 4;
+const size_t RANGE_FILTER_BITS_PER_PREFIX = 8;
+const size_t RANGE_FILTER_MAX_PROBES = 64;
+
+// With FILTER_CUCKOO the level filter is rebuilt from the runs whenever it fills up, with room for
+// LEVEL_FILTER_HEADROOM times the entries of the tree plus a buffer.
+const double LEVEL_FILTER_HEADROOM = 1.5;
+
+// Gets queued back to back are answered by `multiGet()`, which keeps up to GET_BATCH_WIDTH lookups in
+// flight and switches between them at every likely cache miss, prefetching what each one reads next.
+// The server hands it at most GET_BATCH_MAX gets at a time.
+const size_t GET_BATCH_WIDTH = 16;
+const size_t GET_BATCH_MAX = 1024;
+
+// Gets are answered from a row cache of up to ROW_CACHE_ENTRIES recently read keys (0 disables it) when it
+// holds the key, see `RowCache`. Each shard of a `ShardedLSM` has a cache of its own, which only its
+// worker touches, so the cache is sharded along with the tree and needs no locking.
+const size_t ROW_CACHE_ENTRIES = 1 << 14;
+
+// The server hosts a default keyspace and any named keyspaces created with `ks`, see `Keyspaces`. Their
+// buffers share a budget of KEYSPACE_BUFFER_BUDGET_BYTES, room for the default buffers of four trees, and
+// the largest buffer is flushed early whenever they outgrow it. A lone keyspace with the default buffer
+// size never reaches it.
+const size_t KEYSPACE_BUFFER_BUDGET_BYTES = 4 * BUFFER_PAGES * PAGE_SIZE * (sizeof(KEY_TYPE) + sizeof(VAL_TYPE));
 
 // Uncomment the below to create small trees for debugging.
 // const size_t PAGE_SIZE = 3;
 // const size_t BUFFER_PAGES = 1;
 // const size_t SIZE_RATIO = 3;
 // const float BLOOM_TARGET_FPR = 0.01;
+// const size_t FILE_PAGES = 1;
 
 enum Status {
     SUCCESS,
@@ -8,18 +8,78 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <cmath>
+#include <type_traits>
+#include <pthread.h>
+#include <sched.h>
 
 #include "Types.hpp"
 
 // `mmapLevel()`
-// Takes in the name of a file for a level and the level number. Returns an int* pointing to the
-// start of the level array.
+// Takes in the name of a file and the number of entries it must hold. Returns a T* pointing to the
+// start of the mapped array. The file descriptor is closed since the mapping keeps the file open.
 template<typename T>
-T* mmapLevel(const char* fileName, size_t l) {
+T* mmapLevel(const char* fileName, size_t capacity) {
     int fd = open(fileName, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
-    size_t fileSize = PAGE_SIZE * BUFFER_PAGES * std::pow(SIZE_RATIO, l) * sizeof(T);
+    size_t fileSize = capacity * sizeof(T);
     ftruncate(fd, fileSize);
-    return reinterpret_cast<T*>(mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    T* data = reinterpret_cast<T*>(mmap(nullptr, fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    close(fd);
+    return data;
+}
+
+// `bitmapWords()`
+// Returns the number of 64-bit words needed to hold one bit per entry.
+size_t bitmapWords(size_t capacity) {
+    return (capacity + 63) / 64;
+}
+
+// `mmapBitmap()`
+// Like `mmapLevel()`, but maps a bitmap holding one bit per entry. Used for tombstones.
+uint64_t* mmapBitmap(const char* fileName, size_t capacity) {
+    return mmapLevel<uint64_t>(fileName, bitmapWords(capacity));
+}
+
+// `radixSort()`
+// Stable LSD radix sort of (key, index) pairs by key for integral key types, one byte per pass.
+// Signed keys have their sign bit flipped so negative keys sort first. Passes in which every key
+// has the same byte are skipped. `scratch` must be the same size as `pairs` and is clobbered.
+template<typename KeyType>
+void radixSort(std::vector<std::pair<KeyType, uint32_t>>& pairs, std::vector<std::pair<KeyType, uint32_t>>& scratch) {
+    static_assert(std::is_integral_v<KeyType>, "radixSort() only supports integral keys.");
+    using UnsignedKey = std::make_unsigned_t<KeyType>;
+    const UnsignedKey flip = std::is_signed_v<KeyType> ? static_cast<UnsignedKey>(static_cast<UnsignedKey>(1) << (sizeof(KeyType) * 8 - 1)) : 0;
+    if (pairs.empty()) return;
+
+    for (size_t shift = 0; shift < sizeof(KeyType) * 8; shift += 8) {
+        auto digit = [&](const std::pair<KeyType, uint32_t>& pair) {
+            return ((static_cast<UnsignedKey>(pair.first) ^ flip) >> shift) & 0xFF;
+        };
+        size_t counts[256] = {0};
+        for (const std::pair<KeyType, uint32_t>& pair : pairs) counts[digit(pair)]++;
+        if (counts[digit(pairs[0])] == pairs.size()) continue;
+
+        size_t offset = 0;
+        for (size_t& count : counts) {
+            size_t bucketSize = count;
+            count = offset;
+            offset += bucketSize;
+        }
+        for (const std::pair<KeyType, uint32_t>& pair : pairs) scratch[counts[digit(pair)]++] = pair;
+        pairs.swap(scratch);
+    }
+}
+
+// `pinThreadToCore()`
+// Pins the calling thread to a single core. Only supported on Linux; elsewhere this does nothing.
+void pinThreadToCore(size_t core) {
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+#else
+    (void)core;
+#endif
 }
 
 // `parseCommand()`
@@ -41,7 +101,67 @@ bool isNum(const std::string& str) {
     return iss.eof() && !iss.fail(); 
 }
 
-std::string mapToString(const std::map<KEY_TYPE, VAL_TYPE>& map) {
+// `parseToken()`
+// Parses a command token into a key or value. Arithmetic types must be numbers, while byte strings
+// take the token as is. Returns false if the token is not valid for the type.
+template<typename T>
+bool parseToken(const std::string& token, T& out) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        out = token;
+        return true;
+    } else {
+        if (!isNum(token)) return false;
+        out = static_cast<T>(std::stoll(token));
+        return true;
+    }
+}
+
+// `valueToString()`
+// Formats a value for a reply to the client.
+template<typename T>
+std::string valueToString(const T& value) {
+    if constexpr (std::is_same_v<T, std::string>) return value;
+    else return std::to_string(value);
+}
+
+// `foldOperand()`
+// Applies the operand of an `a` command to the older value of its key: numbers are added, and byte
+// strings are appended. A key without a value folds onto `T()`.
+template<typename T>
+T foldOperand(const T& older, const T& operand) {
+    return older + operand;
+}
+
+// `parseRangeLimit()`
+// Parses the `n [asc|desc]` tokens that follow the bounds of a limited range command. The limit must be
+// positive, and the order defaults to ascending.
+bool parseRangeLimit(const std::vector<std::string>& tokens, size_t& limit, bool& reverse) {
+    int64_t parsed;
+    if (tokens.size() < 4 || tokens.size() > 5 || !parseToken(tokens[3], parsed) || parsed <= 0) return false;
+    limit = static_cast<size_t>(parsed);
+    reverse = tokens.size() == 5 && tokens[4] == "desc";
+    return tokens.size() == 4 || tokens[4] == "asc" || reverse;
+}
+
+// `pageToString()`
+// Formats the first `limit` pairs of a limited range like `mapToString()`, in the order given. If there
+// are more pairs, it appends the continuation token `next=K`: the left bound of the next page for an
+// ascending range, or the right bound of the next page for a descending one.
+template<typename KeyType, typename ValType>
+std::string pageToString(const std::vector<std::pair<KeyType, ValType>>& pairs, size_t limit, bool reverse) {
+    std::stringstream ss;
+    ss << "[";
+    for (size_t i = 0; i < pairs.size() && i < limit; i++) {
+        if (i > 0) ss << ", ";
+        ss << pairs[i].first << ":" << pairs[i].second;
+    }
+    ss << "]";
+    if (pairs.size() > limit) ss << " next=" << (reverse ? pairs[limit - 1].first : pairs[limit].first);
+    return ss.str();
+}
+
+template<typename KeyType, typename ValType>
+std::string mapToString(const std::map<KeyType, ValType>& map) {
     std::stringstream ss;
     ss << "[";
     if (!map.empty()) {
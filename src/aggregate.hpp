@@ -0,0 +1,68 @@
+#ifndef AGGREGATE_HPP
+#define AGGREGATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sstream>
+#include <type_traits>
+
+// `Aggregate`
+// The COUNT, SUM, MIN, and MAX of a set of values. Only the count is kept for values that are not
+// arithmetic. Integral sums are kept in 64 bits and wrap around on overflow.
+template<typename ValType>
+struct Aggregate {
+    using SumType = std::conditional_t<std::is_floating_point_v<ValType>, double, int64_t>;
+
+    size_t count = 0;
+    SumType sum = 0;
+    ValType min = ValType();
+    ValType max = ValType();
+
+    void add(const ValType& val) {
+        if constexpr (std::is_arithmetic_v<ValType>) {
+            this->sum += static_cast<SumType>(val);
+            if (this->count == 0 || val < this->min) this->min = val;
+            if (this->count == 0 || this->max < val) this->max = val;
+        }
+        this->count++;
+    }
+
+    // `Aggregate::remove()`
+    // Takes a value that was added back out. Returns false, leaving the aggregate as it was, if the
+    // value is the MIN or MAX, since the next smallest or largest value is not known.
+    bool remove(const ValType& val) {
+        if constexpr (std::is_arithmetic_v<ValType>) {
+            if (!(this->min < val) || !(val < this->max)) return false;
+            this->sum -= static_cast<SumType>(val);
+        }
+        this->count--;
+        return true;
+    }
+
+    Aggregate& operator+=(const Aggregate& other) {
+        if (other.count == 0) return *this;
+        if constexpr (std::is_arithmetic_v<ValType>) {
+            this->sum += other.sum;
+            if (this->count == 0 || other.min < this->min) this->min = other.min;
+            if (this->count == 0 || this->max < other.max) this->max = other.max;
+        }
+        this->count += other.count;
+        return *this;
+    }
+};
+
+// `aggregateToString()`
+// Formats an aggregate as `count=N sum=S min=A max=B`. The sum, min, and max are left out when there
+// are no values, or when the values are not arithmetic.
+template<typename ValType>
+std::string aggregateToString(const Aggregate<ValType>& aggregate) {
+    std::ostringstream ss;
+    ss << "count=" << aggregate.count;
+    if constexpr (std::is_arithmetic_v<ValType>) {
+        if (aggregate.count > 0) ss << " sum=" << aggregate.sum << " min=" << aggregate.min << " max=" << aggregate.max;
+    }
+    return ss.str();
+}
+
+#endif
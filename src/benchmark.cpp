@@ -0,0 +1,288 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <iomanip>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+#include "lsm.hpp"
+#include "workload.hpp"
+
+// Benchmarks for the LSM tree, linked directly against the `LSM` template. Run `make benchmark`, then
+//
+//     ./benchmark [--n OPS] [--keys KEYS] [--seed SEED] [--format csv|json] [--out FILE] [--only NAME]
+//
+// Each benchmark times every operation individually and reports the throughput and latency
+// percentiles, one row per benchmark. `--only` runs the benchmarks whose names contain NAME.
+
+using Tree = LSM<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE>;
+using TreeRun = Run<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE, Policy<>>;
+
+struct BenchmarkOptions {
+    size_t numOps = 100000;
+    size_t numKeys = 1000000;
+    uint64_t seed = 42;
+    std::string format = "csv";
+    std::string out;
+    std::string only;
+};
+
+// `BenchmarkResult`
+// The latencies of the operations timed by one benchmark.
+struct BenchmarkResult {
+    std::string name;
+    Latencies latencies;
+    double seconds = 0;
+};
+
+// `Benchmark`
+// Runs the benchmarks against fresh trees in the `bench_data` folder.
+class Benchmark {
+    private:
+        BenchmarkOptions options;
+        std::mt19937_64 rng;
+        std::vector<BenchmarkResult> results;
+
+        // `Benchmark::time()`
+        // Runs `op(i)` for i in [0, numOps) and records the latency of each call.
+        void time(const std::string& name, size_t numOps, const std::function<void(size_t)>& op) {
+            BenchmarkResult result;
+            result.name = name;
+            result.latencies.samples.reserve(numOps);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < numOps; i++) {
+                auto opStart = std::chrono::steady_clock::now();
+                op(i);
+                auto opEnd = std::chrono::steady_clock::now();
+                result.latencies.add(std::chrono::duration<double, std::nano>(opEnd - opStart).count());
+            }
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            result.latencies.sort();
+            this->results.push_back(std::move(result));
+        }
+
+        bool selected(const std::string& name) {
+            return name.find(this->options.only) != std::string::npos;
+        }
+
+        uint64_t randomKey() {
+            return this->rng() % this->options.numKeys;
+        }
+
+        // `Benchmark::load()`
+        // Returns a fresh tree holding every even key below `numKeys` in random order, so that even keys
+        // hit and odd keys miss.
+        std::unique_ptr<Tree> load() {
+            std::filesystem::remove_all("bench_data");
+            std::unique_ptr<Tree> tree = std::make_unique<Tree>("bench_data");
+            std::vector<uint64_t> keys;
+            for (uint64_t k = 0; k < this->options.numKeys; k += 2) keys.push_back(k);
+            std::shuffle(keys.begin(), keys.end(), this->rng);
+            for (uint64_t k : keys) tree->put(SUCCESS, makeKey<KEY_TYPE>(k), makeVal<VAL_TYPE>(k), false);
+            return tree;
+        }
+
+        // `Benchmark::deepestRun()`
+        // Returns a run of the last level, which is where most probes end up.
+        TreeRun* deepestRun(Tree& tree) {
+            for (size_t l = tree.getNumLevels() - 1; l > 0; l--) {
+                const auto& runs = tree.getLevel(l)->runs;
+                if (!runs.empty()) return runs[runs.size() / 2];
+            }
+            return tree.getBuffer();
+        }
+
+    public:
+        Benchmark(const BenchmarkOptions& options) : options(options), rng(options.seed) {}
+
+        void run() {
+            size_t n = this->options.numOps;
+
+            if (this->selected("put")) {
+                std::filesystem::remove_all("bench_data");
+                Tree tree("bench_data");
+                this->time("put", n, [&](size_t) {
+                    uint64_t k = this->randomKey();
+                    tree.put(SUCCESS, makeKey<KEY_TYPE>(k), makeVal<VAL_TYPE>(k), false);
+                });
+                tree.shutdownServer("sw");
+            }
+
+            if (this->selected("flush")) {
+                // Fill the buffer without triggering a flush, then time the sort alone and the whole flush.
+                std::filesystem::remove_all("bench_data");
+                Tree tree("bench_data");
+                size_t flushes = std::max<size_t>(1, n / tree.getBufferSize());
+                auto fill = [&]() {
+                    while (tree.getBuffer()->numPairs < tree.getBuffer()->capacity) {
+                        uint64_t k = this->randomKey();
+                        tree.appendPair(tree.getBuffer(), makeKey<KEY_TYPE>(k), makeVal<VAL_TYPE>(k), false, false);
+                    }
+                };
+                fill();
+                this->time("flush_sort", flushes, [&](size_t) { tree.sortBuffer(); });
+                this->time("flush", flushes, [&](size_t) {
+                    fill();
+                    tree.flushBuffer();
+                });
+                tree.shutdownServer("sw");
+            }
+
+            if (this->selected("merge") || this->selected("bloom") || this->selected("fence") || this->selected("get") || this->selected("range") || this->selected("aggregate")) {
+                std::unique_ptr<Tree> tree = this->load();
+                TreeRun* run = this->deepestRun(*tree);
+
+                if (this->selected("bloom")) {
+                    this->time("bloom_probe", n, [&](size_t) { tree->searchBloomFilter(run, makeKey<KEY_TYPE>(this->randomKey())); });
+                }
+                if (this->selected("fence")) {
+                    this->time("fence_search", n, [&](size_t) { tree->searchFence(run, makeKey<KEY_TYPE>(this->randomKey())); });
+                }
+                if (this->selected("get")) {
+                    this->time("get_hit", n, [&](size_t) { tree->get(SUCCESS, makeKey<KEY_TYPE>(this->randomKey() & ~1ull)); });
+                    this->time("get_miss", n, [&](size_t) { tree->get(SUCCESS, makeKey<KEY_TYPE>(this->randomKey() | 1)); });
+                    // Gets of the stored keys with zipfian popularity, most of which the row cache answers.
+                    ZipfianChooser zipfian(this->options.numKeys / 2);
+                    this->time("get_zipfian", n, [&](size_t) { tree->get(SUCCESS, makeKey<KEY_TYPE>(2 * zipfian.next(this->rng))); });
+                    // Each operation is one batch of GET_BATCH_WIDTH * 4 gets answered by `multiGet()`.
+                    size_t batchSize = GET_BATCH_WIDTH * 4;
+                    std::vector<KEY_TYPE> batch(batchSize);
+                    for (uint64_t mask : {~0ull << 1, ~0ull}) {
+                        std::string name = mask == ~0ull ? "multiget_miss" : "multiget_hit";
+                        this->time(name, std::max<size_t>(1, n / batchSize), [&](size_t) {
+                            for (KEY_TYPE& key : batch) key = makeKey<KEY_TYPE>(mask == ~0ull ? this->randomKey() | 1 : this->randomKey() & mask);
+                            tree->multiGet(SUCCESS, batch);
+                        });
+                    }
+                }
+                if (this->selected("range")) {
+                    for (size_t length : {10, 1000}) {
+                        std::string name = length == 10 ? "range_short" : "range_long";
+                        this->time(name, std::max<size_t>(1, n / length), [&](size_t) {
+                            uint64_t k = this->randomKey();
+                            std::map<KEY_TYPE, VAL_TYPE> found;
+                            tree->collectRange(makeKey<KEY_TYPE>(k), makeKey<KEY_TYPE>(k + 2 * length), found, false);
+                        });
+                    }
+                    // The first 50 pairs of a range over a tenth of the keys, in each direction.
+                    uint64_t width = std::max<uint64_t>(2, this->options.numKeys / 10);
+                    for (bool reverse : {false, true}) {
+                        this->time(reverse ? "range_limit_desc" : "range_limit", std::max<size_t>(1, n / 50), [&](size_t) {
+                            uint64_t k = this->randomKey();
+                            tree->scanRange(makeKey<KEY_TYPE>(k), makeKey<KEY_TYPE>(k + width), 50, reverse);
+                        });
+                    }
+                }
+                if (this->selected("aggregate")) {
+                    // COUNT, SUM, MIN, and MAX over a tenth of the keys, answered mostly from page summaries.
+                    uint64_t width = std::max<uint64_t>(2, this->options.numKeys / 10);
+                    this->time("aggregate_wide", std::max<size_t>(1, n / 1000), [&](size_t) {
+                        uint64_t k = this->randomKey();
+                        tree->aggregateRange(makeKey<KEY_TYPE>(k), makeKey<KEY_TYPE>(k + width));
+                    });
+                }
+                if (this->selected("merge")) {
+                    // Time moving one run of each level into the next, deepest level first so that the
+                    // shallower merges are not skewed by cascades. Cascading compactions are not timed.
+                    for (size_t l = tree->getNumLevels() - 1; l-- > 1; ) {
+                        size_t merges = std::min<size_t>(tree->getLevel(l)->runs.size(), 16);
+                        this->time("merge_l" + std::to_string(l), merges, [&](size_t) {
+                            tree->compactRun(l, tree->pickRun(l));
+                        });
+                        tree->compactLevel(l + 1);
+                    }
+                }
+                tree->shutdownServer("sw");
+            }
+
+            // Macro workloads: random keys over a loaded tree, with the mix of operations given.
+            struct Mix { std::string name; double puts, gets, ranges; };
+            for (const Mix& mix : {Mix{"mixed_write_heavy", 0.9, 0.1, 0}, Mix{"mixed_read_heavy", 0.1, 0.9, 0}, Mix{"mixed_scan", 0.45, 0.45, 0.1}}) {
+                if (!this->selected(mix.name)) continue;
+                std::unique_ptr<Tree> tree = this->load();
+                std::uniform_real_distribution<double> coin(0, 1);
+                this->time(mix.name, n, [&](size_t) {
+                    double x = coin(this->rng);
+                    uint64_t k = this->randomKey();
+                    if (x < mix.puts) {
+                        tree->put(SUCCESS, makeKey<KEY_TYPE>(k), makeVal<VAL_TYPE>(k), false);
+                    } else if (x < mix.puts + mix.gets) {
+                        tree->get(SUCCESS, makeKey<KEY_TYPE>(k));
+                    } else {
+                        std::map<KEY_TYPE, VAL_TYPE> found;
+                        tree->collectRange(makeKey<KEY_TYPE>(k), makeKey<KEY_TYPE>(k + 100), found, false);
+                    }
+                });
+                tree->shutdownServer("sw");
+            }
+            std::filesystem::remove_all("bench_data");
+        }
+
+        // `Benchmark::report()`
+        // Writes one row per benchmark as CSV or a JSON array.
+        void report(std::ostream& out) {
+            out << std::fixed << std::setprecision(1);
+            if (this->options.format == "json") out << "[" << std::endl;
+            else out << "benchmark,ops,seconds,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << std::endl;
+
+            for (size_t i = 0; i < this->results.size(); i++) {
+                const BenchmarkResult& result = this->results[i];
+                size_t ops = result.latencies.count();
+                double opsPerSec = result.seconds > 0 ? ops / result.seconds : 0;
+                if (this->options.format == "json") {
+                    out << "  {\"benchmark\": \"" << result.name << "\", \"ops\": " << ops
+                        << ", \"seconds\": " << std::setprecision(6) << result.seconds << std::setprecision(1)
+                        << ", \"ops_per_sec\": " << opsPerSec << ", \"mean_ns\": " << result.latencies.mean()
+                        << ", \"p50_ns\": " << result.latencies.percentile(50) << ", \"p90_ns\": " << result.latencies.percentile(90)
+                        << ", \"p99_ns\": " << result.latencies.percentile(99) << ", \"p999_ns\": " << result.latencies.percentile(99.9)
+                        << ", \"max_ns\": " << result.latencies.percentile(100) << "}" << (i + 1 < this->results.size() ? "," : "") << std::endl;
+                } else {
+                    out << result.name << "," << ops << "," << std::setprecision(6) << result.seconds << std::setprecision(1) << ","
+                        << opsPerSec << "," << result.latencies.mean() << "," << result.latencies.percentile(50) << "," << result.latencies.percentile(90) << ","
+                        << result.latencies.percentile(99) << "," << result.latencies.percentile(99.9) << "," << result.latencies.percentile(100) << std::endl;
+                }
+            }
+            if (this->options.format == "json") out << "]" << std::endl;
+        }
+};
+
+// `main()`
+// Parses the options, runs the benchmarks with the tree's own output silenced, and reports the results.
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string flag = argv[i], value = argv[i + 1];
+        if (flag == "--n") options.numOps = std::stoull(value);
+        else if (flag == "--keys") options.numKeys = std::stoull(value);
+        else if (flag == "--seed") options.seed = std::stoull(value);
+        else if (flag == "--format") options.format = value;
+        else if (flag == "--out") options.out = value;
+        else if (flag == "--only") options.only = value;
+        else {
+            std::cerr << "Unknown option: " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    // The tree reports progress on stdout, which would interleave with the results.
+    std::ofstream devNull("/dev/null");
+    std::streambuf* stdoutBuffer = std::cout.rdbuf(devNull.rdbuf());
+    Benchmark benchmark(options);
+    benchmark.run();
+    std::cout.rdbuf(stdoutBuffer);
+
+    if (options.out.empty()) {
+        benchmark.report(std::cout);
+    } else {
+        std::ofstream out(options.out);
+        benchmark.report(out);
+    }
+    return 0;
+}
@@ -2,52 +2,103 @@
 #define BLOOM_H
 
 #include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <type_traits>
 
 #include "MurmurHash3.hpp"
 #include "Types.hpp"
 
+// `hashKey()`
+// Hashes a key with the given seed. Byte strings are hashed over their contents.
+template<typename KeyType>
+uint32_t hashKey(const KeyType& key, uint32_t seed) {
+    uint32_t hash;
+    if constexpr (std::is_same_v<KeyType, std::string>) MurmurHash3_x86_32(key.data(), key.size(), seed, &hash);
+    else MurmurHash3_x86_32(&key, sizeof(key), seed, &hash);
+    return hash;
+}
+
+// `BloomHash`
+// The two 64-bit halves of a key's 128-bit hash. Probe i of a bloom filter reads bit (h1 + i * h2)
+// modulo its size (Kirsch and Mitzenmacher), so a key is hashed once however many probes are made,
+// and the same hash serves the filters of every level.
+struct BloomHash {
+    uint64_t h1, h2;
+};
+
+template<typename KeyType>
+BloomHash bloomHash(const KeyType& key) {
+    uint64_t hash[2];
+    if constexpr (std::is_same_v<KeyType, std::string>) MurmurHash3_x64_128(key.data(), key.size(), 0, hash);
+    else MurmurHash3_x64_128(&key, sizeof(key), 0, hash);
+    return {hash[0], hash[1]};
+}
+
+// `BloomFilter`
+// The bits are packed into 64-bit words so that `prefetch()` can pull in the words a probe will read.
 class BloomFilter {
     private:
-        std::vector<bool> bits;
+        std::vector<uint64_t> words;
+        size_t bits;
         size_t numHashes;
 
+        size_t probe(const BloomHash& hash, size_t i) const {
+            return (hash.h1 + i * hash.h2) % this->bits;
+        }
+
     public:
         BloomFilter(size_t numBits, size_t numHashFunctions)
-            : bits(numBits), numHashes(numHashFunctions) {}
+            : words((numBits + 63) / 64), bits(numBits), numHashes(numHashFunctions) {}
         
-        void add(KEY_TYPE key) {
-            uint32_t hash[1];
+        template<typename KeyType>
+        void add(const KeyType& key) {
+            BloomHash hash = bloomHash(key);
             for (size_t i = 0; i < this->numHashes; ++i) {
-                // i is used as the seed.
-                MurmurHash3_x86_32(&key, sizeof(key), i, hash);
-            this->bits[hash[0] % this->bits.size()] = true;
+                size_t bit = this->probe(hash, i);
+                this->words[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
             }
         }
 
-        bool mayContain(KEY_TYPE key) {
-            uint32_t hash[1];
+        template<typename KeyType>
+        bool mayContain(const KeyType& key) {
+            return this->mayContain(bloomHash(key));
+        }
+
+        bool mayContain(const BloomHash& hash) {
             for (size_t i = 0; i < this->numHashes; ++i) {
-                // i is used as the seed.
-                MurmurHash3_x86_32(&key, sizeof(key), i, hash);
-                if (!this->bits[hash[0] % this->bits.size()]) {
+                if (!this->getBit(this->probe(hash, i))) {
                     return false;
                 }
             }
             return true;
         }
 
+        // `BloomFilter::prefetch()`
+        // Starts loading the words that `mayContain(hash)` will read, without waiting for them.
+        void prefetch(const BloomHash& hash) {
+            for (size_t i = 0; i < this->numHashes; ++i) {
+                __builtin_prefetch(&this->words[this->probe(hash, i) / 64]);
+            }
+        }
+
         // `BloomFilter::clear()`
         // Resets the bloom filter bit vector to all false.
         void clear() {
-            std::fill(this->bits.begin(), this->bits.end(), false);
+            std::fill(this->words.begin(), this->words.end(), 0);
         }
 
         size_t numBits() {
-            return this->bits.size();
+            return this->bits;
+        }
+
+        size_t numHashFunctions() {
+            return this->numHashes;
         }
 
         size_t getBit(size_t index) {
-            return this->bits[index];
+            return (this->words[index / 64] >> (index % 64)) & 1;
         }
 };
 
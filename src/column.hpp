@@ -0,0 +1,228 @@
+#ifndef COLUMN_HPP
+#define COLUMN_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+
+// `FixedColumn`
+// The keys or values of a run for a fixed-width type, stored as an mmap'd array of `capacity` entries.
+template<typename T>
+class FixedColumn {
+    private:
+        T* data = nullptr;
+        size_t capacity = 0;
+
+    public:
+        // `FixedColumn::open()`
+        // Maps the column file. The other arguments are only used by `StringColumn`.
+        void open(const std::string& fileName, const std::string& heapFileName, size_t capacity, size_t size, size_t restartInterval) {
+            (void)heapFileName;
+            (void)size;
+            (void)restartInterval;
+            this->capacity = capacity;
+            this->data = mmapLevel<T>(fileName.c_str(), capacity);
+        }
+
+        void close() {
+            munmap(this->data, this->capacity * sizeof(T));
+        }
+
+        T get(size_t i) const {
+            return this->data[i];
+        }
+
+        // `FixedColumn::prefetch()`
+        // Starts loading entry i without waiting for it.
+        void prefetch(size_t i) const {
+            __builtin_prefetch(this->data + i);
+        }
+
+        // `FixedColumn::append()`
+        // Writes entry i, which must be the entry following the last one written.
+        void append(size_t i, const T& value) {
+            this->data[i] = value;
+        }
+
+        // `FixedColumn::set()`
+        // Overwrites entry i in place. Used to repoint a value moved by value log garbage collection.
+        void set(size_t i, const T& value) {
+            this->data[i] = value;
+        }
+
+        void clear() {}
+
+        // `FixedColumn::bytes()`
+        // The bytes taken by the first `size` entries.
+        size_t bytes(size_t size) const {
+            return size * sizeof(T);
+        }
+};
+
+// `StringColumn`
+// The keys or values of a run for byte strings. Entry i starts at `offsets[i]` in a heap file that
+// grows as needed. Entries are grouped into blocks of `restartInterval` entries: the first entry of a
+// block (a restart point) is stored whole, and every other entry only stores the suffix it does not
+// share with the entry before it, as `varint shared, varint unshared, unshared bytes`. Keys are
+// appended in sorted order beneath the buffer, so neighbours share long prefixes. Values use a
+// restart interval of 1, which makes every entry a plain length-prefixed string.
+class StringColumn {
+    private:
+        uint64_t* offsets = nullptr;
+        char* heap = nullptr;
+        size_t capacity = 0;
+        size_t heapCapacity = 0;
+        size_t heapSize = 0;
+        size_t restartInterval = 1;
+        std::string heapFileName;
+        // The last appended entry, which the next entry is compressed against.
+        std::string last;
+        // The last decoded entry, so that scanning a column in order decodes each entry once.
+        mutable size_t cachedIndex = SIZE_MAX;
+        mutable std::string cached;
+
+        // `StringColumn::mapHeap()`
+        // Maps the heap file with room for at least `bytes` bytes.
+        void mapHeap(size_t bytes) {
+            if (this->heap != nullptr) munmap(this->heap, this->heapCapacity);
+            this->heapCapacity = std::max<size_t>(bytes, 64);
+            this->heap = mmapLevel<char>(this->heapFileName.c_str(), this->heapCapacity);
+        }
+
+        void putVarint(uint64_t value) {
+            while (value >= 128) {
+                this->heap[this->heapSize++] = static_cast<char>(value | 128);
+                value >>= 7;
+            }
+            this->heap[this->heapSize++] = static_cast<char>(value);
+        }
+
+        uint64_t getVarint(size_t& position) const {
+            uint64_t value = 0;
+            for (size_t shift = 0; ; shift += 7) {
+                uint8_t byte = static_cast<uint8_t>(this->heap[position++]);
+                value |= static_cast<uint64_t>(byte & 127) << shift;
+                if (byte < 128) return value;
+            }
+        }
+
+        // `StringColumn::decode()`
+        // Applies the entry at `position` to `value`, the entry before it, and returns the position
+        // just past the entry.
+        size_t decode(size_t position, std::string& value) const {
+            size_t shared = this->getVarint(position);
+            size_t unshared = this->getVarint(position);
+            value.resize(shared);
+            value.append(this->heap + position, unshared);
+            return position + unshared;
+        }
+
+    public:
+        // `StringColumn::open()`
+        // Maps the offsets and heap files of a column holding `size` entries.
+        void open(const std::string& fileName, const std::string& heapFileName, size_t capacity, size_t size, size_t restartInterval) {
+            this->capacity = capacity;
+            this->restartInterval = restartInterval;
+            this->heapFileName = heapFileName;
+            this->offsets = mmapLevel<uint64_t>(fileName.c_str(), capacity);
+
+            struct stat heapStat;
+            size_t heapFileSize = stat(heapFileName.c_str(), &heapStat) == 0 ? heapStat.st_size : 0;
+            this->mapHeap(std::max(heapFileSize, capacity * STRING_HEAP_BYTES_PER_ENTRY));
+
+            this->heapSize = 0;
+            this->last.clear();
+            this->cachedIndex = SIZE_MAX;
+            if (size > 0) {
+                this->last = this->get(size - 1);
+                std::string scratch;
+                this->heapSize = this->decode(this->offsets[size - 1], scratch);
+            }
+        }
+
+        void close() {
+            munmap(this->offsets, this->capacity * sizeof(uint64_t));
+            munmap(this->heap, this->heapCapacity);
+        }
+
+        // `StringColumn::get()`
+        // Decodes entry i from the restart point of its block, or from the previous entry if that was
+        // the last one decoded.
+        std::string get(size_t i) const {
+            if (i == this->cachedIndex) return this->cached;
+            size_t start = i - i % this->restartInterval;
+            if (this->cachedIndex == SIZE_MAX || this->cachedIndex < start || i < this->cachedIndex) {
+                this->cached.clear();
+                this->decode(this->offsets[start], this->cached);
+                this->cachedIndex = start;
+            }
+            while (this->cachedIndex < i) {
+                this->decode(this->offsets[++this->cachedIndex], this->cached);
+            }
+            return this->cached;
+        }
+
+        // `StringColumn::prefetch()`
+        // Starts loading the offset of entry i. Where its bytes live is only known once that arrives.
+        void prefetch(size_t i) const {
+            __builtin_prefetch(this->offsets + i);
+        }
+
+        // `StringColumn::append()`
+        // Writes entry i, which must be the entry following the last one written.
+        void append(size_t i, const std::string& value) {
+            size_t shared = 0;
+            if (i % this->restartInterval != 0) {
+                size_t limit = std::min(value.size(), this->last.size());
+                while (shared < limit && value[shared] == this->last[shared]) shared++;
+            }
+            size_t unshared = value.size() - shared;
+            // Two varints take at most 20 bytes.
+            if (this->heapSize + unshared + 20 > this->heapCapacity) this->mapHeap(2 * (this->heapSize + unshared + 20));
+
+            this->offsets[i] = this->heapSize;
+            this->putVarint(shared);
+            this->putVarint(unshared);
+            std::copy(value.begin() + shared, value.end(), this->heap + this->heapSize);
+            this->heapSize += unshared;
+            this->last = value;
+            if (i == this->cachedIndex) this->cachedIndex = SIZE_MAX;
+        }
+
+        // `StringColumn::bytes()`
+        // The bytes taken by the first `size` entries: their offsets and their encoded bytes.
+        size_t bytes(size_t size) const {
+            return size * sizeof(uint64_t) + (size == 0 ? 0 : this->heapSize);
+        }
+
+        void clear() {
+            this->heapSize = 0;
+            this->last.clear();
+            this->cachedIndex = SIZE_MAX;
+        }
+};
+
+// `valueBytes()`
+// The bytes of a key or value as written by a client.
+template<typename T>
+size_t valueBytes(const T& value) {
+    if constexpr (std::is_same_v<T, std::string>) return value.size();
+    else return sizeof(value);
+}
+
+// `Column`
+// The storage used for a key or value type: byte strings go into a `StringColumn`, and every other
+// type into a `FixedColumn`.
+template<typename T>
+using Column = std::conditional_t<std::is_same_v<T, std::string>, StringColumn, FixedColumn<T>>;
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef DICTIONARY_HPP
+#define DICTIONARY_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include <vector>
+#include <limits>
+#include <functional>
+#include <type_traits>
+#include <sys/mman.h>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+
+// `flatHash()`
+// Hashes a key of a `FlatHashMap`. Fixed-width keys are hashed by their bytes with the finalizer of
+// SplitMix64, which is cheap and mixes every input bit into the low bits used for the slot.
+template<typename T>
+uint64_t flatHash(const T& key) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        return std::hash<std::string>()(key);
+    } else {
+        static_assert(sizeof(T) <= sizeof(uint64_t), "flatHash() expects keys of at most 8 bytes");
+        uint64_t hash = 0;
+        std::memcpy(&hash, &key, sizeof(T));
+        hash ^= hash >> 30;
+        hash *= 0xbf58476d1ce4e5b9ull;
+        hash ^= hash >> 27;
+        hash *= 0x94d049bb133111ebull;
+        hash ^= hash >> 31;
+        return hash;
+    }
+}
+
+// `FlatHashMap`
+// An open addressing hash map with linear probing over one array of slots, kept at most half full.
+// Lookups touch one or two adjacent slots instead of walking the nodes of a `std::map`. Entries can
+// only be added, or all removed at once with `clear()`.
+template<typename K, typename V>
+class FlatHashMap {
+    private:
+        struct Slot {
+            K key;
+            V value;
+            bool used = false;
+        };
+        std::vector<Slot> slots;
+        size_t count = 0;
+
+        void grow() {
+            std::vector<Slot> old = std::move(this->slots);
+            this->slots.assign(std::max<size_t>(16, old.size() * 2), Slot());
+            this->count = 0;
+            for (Slot& slot : old) {
+                if (slot.used) this->insert(slot.key, slot.value);
+            }
+        }
+
+    public:
+        // `FlatHashMap::find()`
+        // Returns the value of `key`, or nullptr if it is absent.
+        const V* find(const K& key) const {
+            if (this->slots.empty()) return nullptr;
+            size_t mask = this->slots.size() - 1;
+            for (size_t i = flatHash(key) & mask; this->slots[i].used; i = (i + 1) & mask) {
+                if (this->slots[i].key == key) return &this->slots[i].value;
+            }
+            return nullptr;
+        }
+
+        // `FlatHashMap::insert()`
+        // Adds `key`, which must be absent.
+        void insert(const K& key, const V& value) {
+            if (2 * (this->count + 1) > this->slots.size()) this->grow();
+            size_t mask = this->slots.size() - 1;
+            size_t i = flatHash(key) & mask;
+            while (this->slots[i].used) i = (i + 1) & mask;
+            this->slots[i].key = key;
+            this->slots[i].value = value;
+            this->slots[i].used = true;
+            this->count++;
+        }
+
+        size_t size() const { return this->count; }
+
+        void clear() {
+            for (Slot& slot : this->slots) slot.used = false;
+            this->count = 0;
+        }
+};
+
+// `Dictionary`
+// The dictionary of a run with DICT encoding. The values are stored in the order they were first seen
+// in an mmap'd file, `d<id>.data`, laid out as the number of values followed by the values, so code i
+// decodes to value i and opening a persisted run maps the file without parsing it. The map from
+// values to codes is only needed to append to the run, and is built on the first append.
+template<typename ValType, typename DictValType>
+class Dictionary {
+    private:
+        static constexpr size_t CAPACITY = static_cast<size_t>(std::numeric_limits<DictValType>::max()) + 1;
+        // The first 8 bytes hold the number of values, which keeps the values 8-byte aligned.
+        char* data = nullptr;
+        FlatHashMap<ValType, DictValType> codes;
+        bool indexed = false;
+
+        uint64_t& count() const { return *reinterpret_cast<uint64_t*>(this->data); }
+        ValType* values() const { return reinterpret_cast<ValType*>(this->data + sizeof(uint64_t)); }
+        static size_t fileSize() { return sizeof(uint64_t) + CAPACITY * sizeof(ValType); }
+
+    public:
+        void open(const std::string& fileName) {
+            this->data = mmapLevel<char>(fileName.c_str(), fileSize());
+            this->codes.clear();
+            this->indexed = false;
+        }
+
+        void close() {
+            if (this->data != nullptr) munmap(this->data, fileSize());
+            this->data = nullptr;
+        }
+
+        size_t size() const { return this->count(); }
+
+        ValType decode(DictValType code) const {
+            return this->values()[code];
+        }
+
+        // `Dictionary::encode()`
+        // Returns the code of `val`, adding it to the dictionary if it is new.
+        DictValType encode(const ValType& val) {
+            if (!this->indexed) {
+                for (size_t i = 0; i < this->size(); i++) this->codes.insert(this->values()[i], static_cast<DictValType>(i));
+                this->indexed = true;
+            }
+            if (const DictValType* code = this->codes.find(val)) return *code;
+
+            // If this assertion is failing, it's because there are too many unique values to store in
+            // the number of bits given by DictValType (AKA this workload is not supported). A future
+            // project is to make it so that the tree automatically increases the number of bits used
+            // in the dictionary, but for now it is fixed in `Types.hpp`.
+            assert(this->size() < CAPACITY);
+            DictValType code = static_cast<DictValType>(this->size());
+            this->values()[code] = val;
+            this->count()++;
+            this->codes.insert(val, code);
+            return code;
+        }
+
+        void clear() {
+            this->count() = 0;
+            this->codes.clear();
+            this->indexed = true;
+        }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef KEYSPACES_HPP
+#define KEYSPACES_HPP
+
+#include <string>
+#include <tuple>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+#include "lsm.hpp"
+#include "threadpool.hpp"
+
+// `Keyspace`
+// One named LSM tree, with its own levels, knobs, and data subfolder, and the bytes its buffer held
+// after its last command.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType>
+struct Keyspace {
+    std::unique_ptr<LSM<KeyType, ValType, DictValType, PolicyType>> lsm;
+    size_t bufferBytes = 0;
+};
+
+// `Keyspaces`
+// Hosts several independent LSM trees, or column families, in one process. Commands run on the default
+// keyspace, whose tree lives in the data folder itself as a lone tree would, unless they are prefixed
+// with `ks <name>`, which runs them on the keyspace `name` in `data/keyspace_<name>`, created on first
+// use. The trees share one compaction thread pool and one budget of KEYSPACE_BUFFER_BUDGET_BYTES for
+// their buffers: once their buffers hold more than that, the largest buffer is flushed early, as
+// RocksDB's write buffer manager does, so idle keyspaces do not each pin a full buffer.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType = Policy<>>
+class Keyspaces {
+    private:
+        std::string dataDirectory;
+        // Declared before the trees, which use it until they are destroyed.
+        std::unique_ptr<ThreadPool> compactionPool;
+        Keyspace<KeyType, ValType, DictValType, PolicyType> defaultKeyspace;
+        std::map<std::string, Keyspace<KeyType, ValType, DictValType, PolicyType>> keyspaces;
+        size_t bufferBytes = 0;
+        size_t budgetFlushes = 0;
+
+    public:
+        // Commands on different keyspaces share the compaction pool and the buffer budget, so they are
+        // serialized like the commands of a single tree.
+        static constexpr bool threadSafe = false;
+
+        Keyspaces(std::string dataDirectory = "data") : dataDirectory(dataDirectory) {
+            this->compactionPool = std::make_unique<ThreadPool>(COMPACTION_THREADS > 0 ? COMPACTION_THREADS : std::max(1u, std::thread::hardware_concurrency()));
+            this->defaultKeyspace.lsm = std::make_unique<LSM<KeyType, ValType, DictValType, PolicyType>>(this->dataDirectory, this->compactionPool.get());
+            this->populateKeyspaces();
+            this->account(this->defaultKeyspace);
+        }
+
+        // `populateKeyspaces()`
+        // Opens the named keyspaces recorded in `keyspaces.data`, one name per line.
+        void populateKeyspaces(void) {
+            std::ifstream keyspacesFile(this->dataDirectory + "/keyspaces.data");
+            std::string name;
+            while (keyspacesFile >> name) {
+                if (isKeyspaceName(name)) this->account(this->openKeyspace(name));
+            }
+            keyspacesFile.close();
+        }
+
+        // `shutdownServer()`
+        // Shuts down the named keyspaces, then the default one. `s` also records the names of the
+        // keyspaces, while `sw` wipes the whole data folder along with the default keyspace.
+        void shutdownServer(std::string userCommand) {
+            for (auto& [name, keyspace] : this->keyspaces) keyspace.lsm->shutdownServer(userCommand);
+            if (userCommand != "sw") {
+                std::ofstream keyspacesFile(this->dataDirectory + "/keyspaces.data", std::ios::out | std::ios::trunc);
+                for (const auto& [name, keyspace] : this->keyspaces) keyspacesFile << name << std::endl;
+                keyspacesFile.close();
+            }
+            this->keyspaces.clear();
+            this->defaultKeyspace.lsm->shutdownServer(userCommand);
+            this->defaultKeyspace.lsm.reset();
+        }
+
+        void printStats(void) {
+            this->defaultKeyspace.lsm->printStats();
+            for (auto& [name, keyspace] : this->keyspaces) {
+                std::cout << "\nKeyspace " << name << ":" << std::endl;
+                keyspace.lsm->printStats();
+            }
+            std::cout << "Keyspace budget flushes: " << this->budgetFlushes << std::endl;
+        }
+
+        // `multiGet()`
+        // Looks the keys up in the default keyspace. Prefixed gets go through `processCommand()`.
+        std::vector<std::tuple<Status, std::string>> multiGet(Status status, const std::vector<KeyType>& keys) {
+            return this->defaultKeyspace.lsm->multiGet(status, keys);
+        }
+
+        // `processCommand()`
+        // Runs `ks <name> <command>` on the keyspace `name`, lists the keyspaces for a bare `ks`, and
+        // runs any other command on the default keyspace. Then keeps the buffers within the budget.
+        std::tuple<Status, std::string> processCommand(std::string userCommand) {
+            std::vector<std::string> tokens = parseCommand(userCommand);
+            if (tokens.empty() || tokens[0] != "ks") {
+                auto reply = this->defaultKeyspace.lsm->processCommand(userCommand);
+                this->account(this->defaultKeyspace);
+                return reply;
+            }
+            if (tokens.size() == 1) return std::make_tuple(SUCCESS, this->listKeyspaces());
+
+            if (!isKeyspaceName(tokens[1])) {
+                return std::make_tuple(ERROR, "Invalid keyspace name: " + tokens[1] + " (letters, digits, _ and - only).");
+            }
+            // Shutdown commands apply to the whole process, never to one keyspace.
+            if (tokens.size() == 2 || tokens[2] == "s" || tokens[2] == "sw" || tokens[2] == "shutdown") {
+                return std::make_tuple(ERROR, "Usage: ks <name> <command>, where the command is not a shutdown command.");
+            }
+            std::string command = tokens[2];
+            for (size_t i = 3; i < tokens.size(); i++) command += " " + tokens[i];
+            Keyspace<KeyType, ValType, DictValType, PolicyType>& keyspace = tokens[1] == "default" ? this->defaultKeyspace : this->openKeyspace(tokens[1]);
+            auto reply = keyspace.lsm->processCommand(command);
+            this->account(keyspace);
+            return reply;
+        }
+
+        // `openKeyspace()`
+        // Returns the keyspace `name`, opening its tree first if it is not open yet.
+        Keyspace<KeyType, ValType, DictValType, PolicyType>& openKeyspace(const std::string& name) {
+            Keyspace<KeyType, ValType, DictValType, PolicyType>& keyspace = this->keyspaces[name];
+            if (!keyspace.lsm) {
+                keyspace.lsm = std::make_unique<LSM<KeyType, ValType, DictValType, PolicyType>>(this->dataDirectory + "/keyspace_" + name, this->compactionPool.get());
+            }
+            return keyspace;
+        }
+
+        // `account()`
+        // Records the bytes the buffer of the keyspace now holds. While the buffers of all keyspaces hold
+        // more than the budget, flushes the largest one.
+        void account(Keyspace<KeyType, ValType, DictValType, PolicyType>& keyspace) {
+            this->bufferBytes -= keyspace.bufferBytes;
+            keyspace.bufferBytes = keyspace.lsm->runBytes(keyspace.lsm->getBuffer());
+            this->bufferBytes += keyspace.bufferBytes;
+            while (this->bufferBytes > KEYSPACE_BUFFER_BUDGET_BYTES) {
+                Keyspace<KeyType, ValType, DictValType, PolicyType>* largest = &this->defaultKeyspace;
+                for (auto& [name, other] : this->keyspaces) {
+                    if (other.bufferBytes > largest->bufferBytes) largest = &other;
+                }
+                largest->lsm->flush();
+                this->budgetFlushes++;
+                this->bufferBytes -= largest->bufferBytes;
+                largest->bufferBytes = largest->lsm->runBytes(largest->lsm->getBuffer());
+                this->bufferBytes += largest->bufferBytes;
+            }
+        }
+
+        // `listKeyspaces()`
+        // Describes every keyspace on one line: the entries in its tree and the bytes in its buffer.
+        std::string listKeyspaces(void) {
+            std::stringstream ss;
+            ss << "Keyspaces: " << this->keyspaces.size() + 1 << ", buffers: " << this->bufferBytes << " / " << KEYSPACE_BUFFER_BUDGET_BYTES
+               << " bytes, budget flushes: " << this->budgetFlushes << ", default: " << describe(this->defaultKeyspace);
+            for (auto& [name, keyspace] : this->keyspaces) ss << ", " << name << ": " << describe(keyspace);
+            return ss.str();
+        }
+
+        static std::string describe(Keyspace<KeyType, ValType, DictValType, PolicyType>& keyspace) {
+            size_t entries = 0;
+            for (size_t l = 0; l < keyspace.lsm->getNumLevels(); l++) entries += keyspace.lsm->getPairsInLevel(l);
+            return std::to_string(entries) + " entries, " + std::to_string(keyspace.bufferBytes) + " buffer bytes";
+        }
+
+        // `isKeyspaceName()`
+        // Keyspace names become folder names, so they are limited to letters, digits, `_`, and `-`.
+        static bool isKeyspaceName(const std::string& name) {
+            return !name.empty() && name.size() <= 64 && std::all_of(name.begin(), name.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+            });
+        }
+
+        size_t getNumKeyspaces() { return this->keyspaces.size() + 1; }
+};
+
+#endif
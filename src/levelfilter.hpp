@@ -0,0 +1,200 @@
+#ifndef LEVELFILTER_HPP
+#define LEVELFILTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <limits>
+
+// `LevelFilter`
+// One filter for the whole tree that tells a get which levels may hold an entry for its key, as in
+// Chucky, so a get makes one probe instead of one bloom filter probe per level. It is a cuckoo filter
+// holding an entry per key and level: an 11-bit fingerprint of the key and the level, packed in 16
+// bits. A key's entries can only sit in its two buckets of SLOTS entries, so a lookup reads two words
+// and returns the levels of every entry whose fingerprint matches. Levels from MAX_LEVEL down share
+// the entry of MAX_LEVEL.
+//
+// The other bucket of an entry depends only on its fingerprint and current bucket, so entries can be
+// moved to make room without knowing their keys. An insert that still finds no room after MAX_KICKS
+// moves parks the entry it holds in a small overflow list, and the owner rebuilds the filter larger.
+class LevelFilter {
+    public:
+        static constexpr size_t MAX_LEVEL = 31;
+        // Stands for no level in `update()`.
+        static constexpr size_t NO_LEVEL = std::numeric_limits<size_t>::max();
+
+    private:
+        static constexpr size_t SLOTS = 4;
+        static constexpr size_t LEVEL_BITS = 5;
+        static constexpr size_t FINGERPRINT_BITS = 11;
+        static constexpr size_t MAX_KICKS = 500;
+
+        // Each bucket is a word of SLOTS 16-bit entries, 0 meaning empty.
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(1);
+        std::vector<std::pair<size_t, uint16_t>> overflow;
+        size_t numEntries = 0;
+        uint64_t kicks = 0;
+
+        static uint16_t entryOf(uint64_t hash, size_t level) {
+            uint16_t fingerprint = hash & ((1u << FINGERPRINT_BITS) - 1);
+            if (fingerprint == 0) fingerprint = 1;
+            return (fingerprint << LEVEL_BITS) | std::min(level, MAX_LEVEL);
+        }
+
+        static uint16_t slot(uint64_t bucket, size_t s) {
+            return bucket >> (16 * s);
+        }
+
+        size_t firstBucket(uint64_t hash) const {
+            return static_cast<size_t>((static_cast<unsigned __int128>(hash) * this->buckets.size()) >> 64);
+        }
+
+        // `LevelFilter::otherBucket()`
+        // The other bucket an entry in bucket b may sit in. Going from either bucket to the other is the
+        // same map, so it works for any number of buckets.
+        size_t otherBucket(size_t b, uint16_t entry) const {
+            uint64_t fingerprint = (entry >> LEVEL_BITS) * 0x9e3779b97f4a7c15ull;
+            size_t offset = static_cast<size_t>((static_cast<unsigned __int128>(fingerprint) * this->buckets.size()) >> 64);
+            return (offset + this->buckets.size() - b) % this->buckets.size();
+        }
+
+        bool place(size_t b, uint16_t entry) {
+            for (size_t s = 0; s < SLOTS; s++) {
+                if (slot(this->buckets[b], s) == 0) {
+                    this->buckets[b] |= static_cast<uint64_t>(entry) << (16 * s);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool unplace(size_t b, uint16_t entry) {
+            for (size_t s = 0; s < SLOTS; s++) {
+                if (slot(this->buckets[b], s) == entry) {
+                    this->buckets[b] &= ~(static_cast<uint64_t>(0xffff) << (16 * s));
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        // `LevelFilter::reset()`
+        // Empties the filter and sizes it for `capacity` entries.
+        void reset(size_t capacity) {
+            this->buckets.assign(std::max<size_t>(1, (capacity + SLOTS - 1) / SLOTS), 0);
+            this->overflow.clear();
+            this->numEntries = 0;
+        }
+
+        // `LevelFilter::add()`
+        // Records that the level holds an entry for the key with this hash.
+        void add(uint64_t hash, size_t level) {
+            uint16_t entry = entryOf(hash, level);
+            size_t b = this->firstBucket(hash);
+            this->numEntries++;
+            if (this->place(b, entry)) return;
+            b = this->otherBucket(b, entry);
+            if (this->place(b, entry)) return;
+            for (size_t kick = 0; kick < MAX_KICKS; kick++) {
+                // Swap the entry with one of the bucket, picked in turn, and move that one to its other bucket.
+                size_t s = this->kicks++ % SLOTS;
+                uint16_t victim = slot(this->buckets[b], s);
+                this->buckets[b] ^= static_cast<uint64_t>(victim ^ entry) << (16 * s);
+                entry = victim;
+                b = this->otherBucket(b, entry);
+                if (this->place(b, entry)) return;
+            }
+            this->overflow.emplace_back(b, entry);
+        }
+
+        // `LevelFilter::remove()`
+        // Removes one entry added for the key with this hash and the level.
+        void remove(uint64_t hash, size_t level) {
+            uint16_t entry = entryOf(hash, level);
+            size_t b = this->firstBucket(hash), other = this->otherBucket(b, entry);
+            this->numEntries--;
+            if (this->unplace(b, entry) || this->unplace(other, entry)) return;
+            for (size_t i = 0; i < this->overflow.size(); i++) {
+                if (this->overflow[i].second == entry && (this->overflow[i].first == b || this->overflow[i].first == other)) {
+                    this->overflow.erase(this->overflow.begin() + i);
+                    return;
+                }
+            }
+        }
+
+        // `LevelFilter::update()`
+        // Moves the entry of the key with this hash from level `from` to level `to`, in place when both
+        // are levels. Either may be NO_LEVEL, to add or remove an entry.
+        void update(uint64_t hash, size_t from, size_t to) {
+            if (from == NO_LEVEL) {
+                if (to != NO_LEVEL) this->add(hash, to);
+                return;
+            }
+            if (to == NO_LEVEL) {
+                this->remove(hash, from);
+                return;
+            }
+            uint16_t entry = entryOf(hash, from), moved = entryOf(hash, to);
+            if (entry == moved) return;
+            size_t b = this->firstBucket(hash), other = this->otherBucket(b, entry);
+            for (size_t bucket : {b, other}) {
+                for (size_t s = 0; s < SLOTS; s++) {
+                    if (slot(this->buckets[bucket], s) == entry) {
+                        this->buckets[bucket] ^= static_cast<uint64_t>(entry ^ moved) << (16 * s);
+                        return;
+                    }
+                }
+            }
+            for (auto& [bucket, parked] : this->overflow) {
+                if (parked == entry && (bucket == b || bucket == other)) {
+                    parked = moved;
+                    return;
+                }
+            }
+        }
+
+        // `LevelFilter::levels()`
+        // Returns a bitmap with bit l set if level l may hold an entry for the key with this hash. Bit
+        // MAX_LEVEL stands for every level from MAX_LEVEL down.
+        uint32_t levels(uint64_t hash) const {
+            uint16_t fingerprint = entryOf(hash, 0) >> LEVEL_BITS;
+            size_t b = this->firstBucket(hash), other = this->otherBucket(b, fingerprint << LEVEL_BITS);
+            uint32_t found = 0;
+            for (size_t bucket : {b, other}) {
+                for (size_t s = 0; s < SLOTS; s++) {
+                    uint16_t entry = slot(this->buckets[bucket], s);
+                    if (entry >> LEVEL_BITS == fingerprint) found |= 1u << (entry & MAX_LEVEL);
+                }
+            }
+            for (const auto& [bucket, entry] : this->overflow) {
+                if (entry >> LEVEL_BITS == fingerprint && (bucket == b || bucket == other)) found |= 1u << (entry & MAX_LEVEL);
+            }
+            return found;
+        }
+
+        // `LevelFilter::prefetch()`
+        // Starts loading the buckets that `levels(hash)` will read, without waiting for them.
+        void prefetch(uint64_t hash) const {
+            size_t b = this->firstBucket(hash);
+            __builtin_prefetch(&this->buckets[b]);
+            __builtin_prefetch(&this->buckets[this->otherBucket(b, entryOf(hash, 0))]);
+        }
+
+        // Whether an insert found no room, in which case the filter should be rebuilt larger.
+        bool overflowed() const {
+            return !this->overflow.empty();
+        }
+
+        size_t capacity() const {
+            return this->buckets.size() * SLOTS;
+        }
+
+        size_t size() const {
+            return this->numEntries;
+        }
+};
+
+#endif
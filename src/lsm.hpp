@@ -8,119 +8,225 @@
 #include <limits>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
+#include <type_traits>
+#include <optional>
+#include <algorithm>
+#include <sys/resource.h>
 
 #include "Types.hpp"
 #include "Utils.hpp"
 #include "bloomfilter.hpp"
+#include "rangefilter.hpp"
+#include "levelfilter.hpp"
+#include "rangetombstone.hpp"
+#include "aggregate.hpp"
+#include "threadpool.hpp"
+#include "stats.hpp"
+#include "tuner.hpp"
+#include "column.hpp"
+#include "dictionary.hpp"
+#include "valuelog.hpp"
+#include "rowcache.hpp"
+#include "ratelimiter.hpp"
 #include <unordered_map>
 #include <map>
 #include <chrono>
 
-struct Stats {
-    size_t puts = 0;
-    size_t successfulGets = 0;
-    size_t failedGets = 0;
-    size_t ranges = 0;
-    double rangeLengthSum = 0;
-    VAL_TYPE rangeValueSum = 0; // This is modulo 10**6 since it could get very large.
-    size_t searchLevelCalls = 0;
-    size_t bloomTruePositives = 0;
-    size_t bloomFalsePositives = 0;
-    size_t deletes = 0;
+// `Entry`
+// A single KV pair together with its tombstone and operand bits, as it moves between runs during a merge.
+// An operand holds the argument of an `a` command, which is applied to the older value of the key.
+template<typename KeyType, typename ValType>
+struct Entry {
+    KeyType key;
+    ValType val;
+    bool isDelete;
+    bool isOperand = false;
 };
 
-template<typename KeyType, typename ValType, typename DictValType>
-struct Level {
-    KeyType* keys = nullptr;
-    std::variant<ValType*, DictValType*> vals;
-    bool* tombstone = nullptr;
+// `Run`
+// A run of KV pairs stored in its own set of mmap'd files, similar to an SST file. The buffer is a
+// single unsorted run. Levels beneath the buffer are made of sorted runs with disjoint key ranges.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType>
+struct Run {
+    static_assert(!(std::is_same_v<ValType, std::string> && PolicyType::encoding == ENCODING_DICT), "DICT encoding needs fixed-width values.");
+
+    // The id names the files backing the run: `k<id>.data`, `v<id>.data`, `t<id>.data`, ... String
+    // columns also have a heap file, `kh<id>.data` or `vh<id>.data`.
+    size_t id = 0;
+    size_t capacity = 0;
+    Column<KeyType> keys;
+    // With DICT encoding the values column holds dictionary codes instead of values, and with VLOG
+    // encoding it holds pointers into the value log.
+    using StoredValType = std::conditional_t<PolicyType::encoding == ENCODING_DICT, DictValType,
+                                             std::conditional_t<PolicyType::encoding == ENCODING_VLOG, uint64_t, ValType>>;
+    Column<StoredValType> vals;
+    // Tombstones are packed into a bitmap with one bit per entry. `pageTombstones` counts the
+    // tombstones on each page so that scans can skip the bitmap for tombstone-free pages.
+    uint64_t* tombstone = nullptr;
+    std::vector<size_t> pageTombstones;
+    // The aggregate of the live values on each page, which range aggregates use in place of reading
+    // the page. Not kept with VLOG encoding, since merges only see value log pointers.
+    std::vector<Aggregate<ValType>> pageSummaries;
+    size_t numTombstones = 0;
+    // Operands (see `Entry`) are marked in a second bitmap, `o<id>.data`. Their values are deltas, so
+    // range aggregates scan the runs holding them instead of using the page summaries.
+    uint64_t* operand = nullptr;
+    size_t numOperands = 0;
+    // The buffer flush count at which the oldest tombstone entered this run.
+    size_t tombstonesSince = std::numeric_limits<size_t>::max();
     size_t numPairs = 0;
+    // The first key of each page. Only built with INDEX_FENCE.
     KeyType* fence = nullptr;
     size_t fenceLength = 0;
+    // The bloom filter is only built with FILTER_BLOOM, and the range filter unless the filter is
+    // FILTER_NONE, for keys with a `rangeKey()`.
     BloomFilter* bloomFilter = nullptr;
-    EncodingType encodingType = ENCODING_TYPE;
+    RangeFilter* rangeFilter = nullptr;
 
-    // Note here the mapping from ValType to DictValType. See `Types.hpp` for more explanation.
-    std::map<ValType, DictValType> dict;
-    std::vector<ValType> dictReverse;
+    // Note here the mapping from ValType to DictValType. See `Types.hpp` for more explanation. Only
+    // opened with DICT encoding.
+    Dictionary<ValType, DictValType> dict;
 
-    ~Level() {
+    ~Run() {
         delete[] fence;
         delete bloomFilter;
+        delete rangeFilter;
     }
 };
 
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType>
+struct Level {
+    // l0 holds exactly one run, the buffer. Deeper levels hold runs ordered by key with disjoint key
+    // ranges. Each run owns the key span from its first key up to the first key of the next run.
+    std::vector<Run<KeyType, ValType, DictValType, PolicyType>*> runs;
+
+    // Range tombstones written by `dr` commands. The ranges held by a level only delete entries in
+    // deeper (older) levels: entries in the same level are either newer or were dropped when the
+    // range tombstone was written or merged in.
+    RangeTombstones<KeyType> rangeTombstones;
+    size_t rangeTombstonesSince = std::numeric_limits<size_t>::max();
+
+    // The last key of the most recently compacted run. Runs are picked for compaction round-robin
+    // from here so that every part of the key space is merged down in turn.
+    std::optional<KeyType> compactionCursor;
+};
+
 // `LSM`
-// A log structured merge tree class.
-template<typename KeyType, typename ValType, typename DictValType>
+// A log structured merge tree class. `PolicyType` fixes the encoding, filter, index, and merge policy
+// at compile time; see `Policy` in `Types.hpp`.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType = Policy<>>
 class LSM {
     private:
-        // The page size is the number of entries in a page.
-        size_t pageSize = PAGE_SIZE;
-        // bufferPages is the number of pages in the buffer.
-        size_t bufferPages = BUFFER_PAGES;
+        // The value an `Entry` carries from one run to another: the value itself, or with VLOG encoding its
+        // pointer into the value log, so that merges never copy values.
+        using EntryValType = std::conditional_t<PolicyType::encoding == ENCODING_VLOG, uint64_t, ValType>;
+        using MergeEntry = Entry<KeyType, EntryValType>;
+        // A change a merge makes to the level filter: the entry for the key with this hash moves from level
+        // `from` to level `to`, either of which may be `LevelFilter::NO_LEVEL`. See `mergePartition()`.
+        struct LevelChange {
+            uint64_t hash;
+            size_t from, to;
+        };
+
+        // The folder holding the catalog and the files of every run.
+        std::string dataDirectory;
+        // The page size, buffer size, size ratio, and bloom filter settings. See `Knobs` in `tuner.hpp`.
+        Knobs knobs;
         size_t numLevels = 0;
-        size_t sizeRatio = SIZE_RATIO;
-        std::vector<Level<KeyType, ValType, DictValType>*> levels = {};
+        // The number of times the buffer has been flushed, used to age tombstones.
+        size_t flushes = 0;
+        size_t nextRunId = 0;
+        std::vector<Level<KeyType, ValType, DictValType, PolicyType>*> levels = {};
+        // Runs that have been merged away. Their files stay mapped and are reused by `createRun()`,
+        // which avoids creating, truncating, and faulting in fresh files on every merge.
+        std::vector<Run<KeyType, ValType, DictValType, PolicyType>*> recycledRuns = {};
+        std::mutex runsMutex;
+        // Scratch space reused by `sortBuffer()` on every flush.
+        std::vector<std::pair<KeyType, uint32_t>> sortPairs, sortScratch;
+        std::vector<MergeEntry> flushEntries;
+        // Workers running the subcompactions of large merges in parallel: a pool of the tree's own, or one
+        // shared with other trees, see `Keyspaces`.
+        std::unique_ptr<ThreadPool> ownCompactionPool;
+        ThreadPool* compactionPool = nullptr;
+        // Paces the merges beneath each flush, see `compactPending()`.
+        CompactionLimiter compactionLimiter{COMPACTION_RATE};
         Stats stats;
-    
+        Tuner tuner;
+        // The tuner's latest recommendation, if it has made one.
+        std::optional<Knobs> recommendation;
+        // Only opened with VLOG encoding.
+        ValueLog<KeyType, ValType> valueLog;
+        // Only used with FILTER_CUCKOO: the levels holding each key, in place of per-run bloom filters.
+        LevelFilter levelFilter;
+        // The results of recent gets, see `RowCache`.
+        RowCache<KeyType, ValType> rowCache{ROW_CACHE_ENTRIES};
+
     public:
-        LSM() {
+        // Commands must not be issued from several threads at once. See `ShardedLSM` for a tree that
+        // takes concurrent commands.
+        static constexpr bool threadSafe = false;
+
+        LSM(std::string dataDirectory = "data", ThreadPool* compactionPool = nullptr) : dataDirectory(dataDirectory), compactionPool(compactionPool) {
+            if (this->compactionPool == nullptr) {
+                this->ownCompactionPool = std::make_unique<ThreadPool>(COMPACTION_THREADS > 0 ? COMPACTION_THREADS : std::max(1u, std::thread::hardware_concurrency()));
+                this->compactionPool = this->ownCompactionPool.get();
+            }
             assert(this->getPageSize() > 0);
             assert(this->getBufferSize() > 0);
             assert(this->getSizeRatio() > 0);
+            assert(this->getRunCapacity() > 0);
 
             this->populateCatalog();
         }
 
         // `populateCatalog()`
         // Populates the catalog with persisted data or creates a data folder if one does not exist.
+        // The first line of the catalog holds the knobs. Each following line describes a level as the
+        // number of runs followed by `id numPairs capacity` for each run, in key order.
         void populateCatalog(void) {
             // Create the data folder if it does not exist.
-            if (!std::filesystem::exists("data")) std::filesystem::create_directory("data");
+            if (!std::filesystem::exists(this->dataDirectory)) std::filesystem::create_directories(this->dataDirectory);
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) this->valueLog.open(this->dataDirectory);
 
-            if (!std::filesystem::exists("data/catalog.data")) {
+            if (!std::filesystem::exists(this->dataDirectory + "/catalog.data")) {
                 // The database is being started from scratch. We start just with l0.
-                KeyType* keysPointer = mmapLevel<KeyType>("data/k0.data", 0);
-                void* valsPointer = nullptr;
-                if (ENCODING_TYPE == ENCODING_OFF) valsPointer = mmapLevel<ValType>("data/v0.data", 0);
-                else if (ENCODING_TYPE == ENCODING_DICT) valsPointer = mmapLevel<DictValType>("data/v0.data", 0);
-                bool* tombstonePointer = mmapLevel<bool>("data/t0.data", 0);
-                this->initializeLevel(0, keysPointer, valsPointer, tombstonePointer, 0);
+                this->initializeLevel(0);
+                this->getLevel(0)->runs.push_back(this->createRun(this->getBufferSize(), this->bloomFpr(0)));
                 // std::cout << "Started new database from scratch.\n" << std::endl;
             } else {
                 // We are populating the catalog with persisted data.
-                std::ifstream catalogFile("data/catalog.data");
-                size_t numPairs = 0, l = 0;
-                while (catalogFile >> numPairs) {
-                    KeyType* keysPointer = mmapLevel<KeyType>(("data/k" + std::to_string(l) + ".data").c_str(), l);
-                    void* valsPointer = nullptr;
-                    if (ENCODING_TYPE == ENCODING_OFF) valsPointer = mmapLevel<ValType>(("data/v" + std::to_string(l) + ".data").c_str(), l);
-                    else if (ENCODING_TYPE == ENCODING_DICT) valsPointer = mmapLevel<DictValType>(("data/v" + std::to_string(l) + ".data").c_str(), l);
-                    bool* tombstonePointer = mmapLevel<bool>(("data/t" + std::to_string(l) + ".data").c_str(), l);
-                    this->initializeLevel(l, keysPointer, valsPointer, tombstonePointer, numPairs);
-
-                    // Populate the dictionary from persisted dictionary files.
-                    std::ifstream dictStream ("data/dict" + std::to_string(l) + ".data");
-                    ValType val;
-                    DictValType encodedVal;
-                    while (dictStream >> val >> encodedVal) {
-                        this->getLevel(l)->dict[val] = encodedVal;
-                    }
-                    dictStream.close();
-
-                    // Construct the dictReverse array.
-                    std::ifstream dictReverseStream ("data/dictreverse" + std::to_string(l) + ".data");
-                    ValType valReverse;
-                    while (dictReverseStream >> valReverse) {
-                        this->getLevel(l)->dictReverse.push_back(valReverse);
-                    }
-                    dictReverseStream.close();
+                std::ifstream catalogFile(this->dataDirectory + "/catalog.data");
+                int bloomAllocation = 0, tunerMode = 0;
+                catalogFile >> this->knobs.pageSize >> this->knobs.bufferPages >> this->knobs.filePages >> this->knobs.sizeRatio
+                            >> this->knobs.bloomTargetFpr >> bloomAllocation >> tunerMode;
+                this->knobs.bloomAllocation = static_cast<BloomAllocation>(bloomAllocation);
+                this->knobs.tunerMode = static_cast<TunerMode>(tunerMode);
+
+                size_t numRuns = 0, l = 0;
+                while (catalogFile >> numRuns) {
+                    this->initializeLevel(l);
+                    for (size_t r = 0; r < numRuns; r++) {
+                        size_t id = 0, numPairs = 0, capacity = 0;
+                        catalogFile >> id >> numPairs >> capacity;
+                        this->getLevel(l)->runs.push_back(this->loadRun(id, capacity, numPairs, this->bloomFpr(l)));
+                        this->nextRunId = std::max(this->nextRunId, id + 1);
+                    }
+
+                    // Load the range tombstones.
+                    std::ifstream rangeTombstoneStream (this->dataDirectory + "/rt" + std::to_string(l) + ".data");
+                    KeyType start, end;
+                    while (rangeTombstoneStream >> start >> end) {
+                        this->getLevel(l)->rangeTombstones.add(start, end);
+                    }
+                    rangeTombstoneStream.close();
+                    if (!this->getLevel(l)->rangeTombstones.empty()) this->getLevel(l)->rangeTombstonesSince = this->flushes;
 
                     l++;
                 }
                 std::cout << "Loaded persisted data.\n" << std::endl;
             }
+            this->rebuildLevelFilter();
         }
 
         // `shutdownServer()`
@@ -128,60 +234,116 @@ class LSM {
         // and frees levels. `s` persists the data in the data folder and `sw` wipes the data folder.
         void shutdownServer(std::string userCommand) {
             if (userCommand == "sw") {
-                std::filesystem::remove_all("data");
+                std::filesystem::remove_all(this->dataDirectory);
                 std::cout << "Wiped data folder." << std::endl;
             } else {
-                // Write the number of pairs per level into the catalog file.
-                std::ofstream catalogFile("data/catalog.data", std::ios::out);
+                // Write the runs of each level into the catalog file.
+                std::ofstream catalogFile(this->dataDirectory + "/catalog.data", std::ios::out);
+                catalogFile << this->knobs.pageSize << " " << this->knobs.bufferPages << " " << this->knobs.filePages << " " << this->knobs.sizeRatio
+                            << " " << std::setprecision(17) << this->knobs.bloomTargetFpr << " " << this->knobs.bloomAllocation << " " << this->knobs.tunerMode << std::endl;
                 for (size_t l = 0; l < this->getNumLevels(); l++) {
-                    catalogFile << this->getPairsInLevel(l) << std::endl;
+                    catalogFile << this->getLevel(l)->runs.size();
+                    for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                        catalogFile << " " << run->id << " " << run->numPairs << " " << run->capacity;
+                    }
+                    catalogFile << std::endl;
                 }
                 catalogFile.close();
 
-                // Persist the dictionaries.
+                // The dictionaries and the value log are mmap'd like the columns, so they are already in their files.
                 for (size_t l = 0; l < this->getNumLevels(); l++) {
-                    // std::cout << "Persisting dict for level " << l << std::endl;
-                    std::ofstream dictStream ("data/dict" + std::to_string(l) + ".data", std::ios::out | std::ios::trunc);
-                    for (const auto& x : this->getLevel(l)->dict) {
-                        dictStream << x.first << " " << x.second << std::endl;
-                    }
-                    dictStream.close();
-
-                    // std::cout << "Persisting dictreverse for level " << l << std::endl;
-                    std::ofstream dictReverseStream ("data/dictreverse" + std::to_string(l) + ".data", std::ios::out | std::ios::trunc);
-                    for (size_t i = 0; i < this->getLevel(l)->dictReverse.size(); i++) {
-                        dictReverseStream << this->getLevel(l)->dictReverse[i] << std::endl;
+                    std::ofstream rangeTombstoneStream (this->dataDirectory + "/rt" + std::to_string(l) + ".data", std::ios::out | std::ios::trunc);
+                    for (const auto& range : this->getLevel(l)->rangeTombstones) {
+                        rangeTombstoneStream << range.first << " " << range.second << std::endl;
                     }
-                    dictReverseStream.close();
+                    rangeTombstoneStream.close();
                 }
 
                 std::cout << "Persisted data folder." << std::endl;
             }
 
             for (size_t l = 0; l < this->getNumLevels(); l++) {
-                munmap(this->getLevelKeys(l), this->getPairsInLevel(l) * sizeof(KeyType));
-                if (this->getLevel(l)->encodingType == ENCODING_OFF) munmap(this->getLevelVals(l), this->getPairsInLevel(l) * sizeof(ValType));
-                else if (this->getLevel(l)->encodingType == ENCODING_DICT) munmap(this->getLevelVals(l), this->getPairsInLevel(l) * sizeof(DictValType));
-                munmap(this->getLevelTombstone(l), this->getPairsInLevel(l) * sizeof(bool));
-
+                for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                    this->unmapRun(run);
+                    delete run;
+                }
                 delete this->getLevel(l);
             }
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->recycledRuns) {
+                this->unmapRun(run);
+                this->removeRunFiles(run);
+                delete run;
+            }
+            this->valueLog.close();
         }
 
         void printStats(void) {
-            // std::cout << "\n ——— Session statistics ——— \n" << std::endl;
-            std::cout << "\nPuts: " << this->stats.puts << std::endl;
-            std::cout << "Successful gets: " << this->stats.successfulGets << std::endl;
-            std::cout << "Failed gets: " << this->stats.failedGets << std::endl;
-            std::cout << "Ranges: " << this->stats.ranges << std::endl;
-            std::cout << "Sum length of all ranges: " << this->stats.rangeLengthSum << std::endl;
-            std::cout << "Range Value Sum % 10^6: " << this->stats.rangeValueSum << std::endl;
-            // std::cout << "Calls to searchLevel(): " << this->stats.searchLevelCalls << std::endl;
-            // std::cout << "Bloom true positives: " << this->stats.bloomTruePositives << std::endl;
-            // std::cout << "Bloom false positives: " << this->stats.bloomFalsePositives << std::endl;
-            std::cout << "Bloom FPR: " << (float)this->stats.bloomFalsePositives / (float)(this->stats.bloomFalsePositives + (this->stats.searchLevelCalls - this->stats.bloomTruePositives)) << std::endl;
-            std::cout << "Deletes: " << this->stats.deletes << std::endl;
-            // std::cout << "\n —————————————————————————— \n" << std::endl;
+            ::printStats(this->getStats());
+            if (this->recommendation) std::cout << "Tuner recommends: " << knobsToString(*this->recommendation) << std::endl;
+        }
+
+        // `setKnob()`
+        // Sets a knob by the name printed by the `k` command. Returns false if the name or value is invalid.
+        bool setKnob(const std::string& name, const std::string& value) {
+            Knobs next = this->knobs;
+            std::istringstream valueStream(value);
+            if (name == "bloom_allocation" && (value == "uniform" || value == "monkey")) {
+                next.bloomAllocation = value == "monkey" ? BLOOM_MONKEY : BLOOM_UNIFORM;
+            } else if (name == "tuner" && (value == "off" || value == "recommend" || value == "apply")) {
+                next.tunerMode = value == "apply" ? TUNER_APPLY : value == "recommend" ? TUNER_RECOMMEND : TUNER_OFF;
+            } else if (name == "bloom_fpr") {
+                if (!(valueStream >> next.bloomTargetFpr) || !valueStream.eof() || !(0 < next.bloomTargetFpr && next.bloomTargetFpr <= 1)) return false;
+            } else {
+                size_t* knob = name == "page_size" ? &next.pageSize : name == "buffer_pages" ? &next.bufferPages
+                             : name == "file_pages" ? &next.filePages : name == "size_ratio" ? &next.sizeRatio : nullptr;
+                if (knob == nullptr || !isNum(value) || std::stoll(value) < (name == "size_ratio" ? 2 : 1)) return false;
+                *knob = std::stoull(value);
+            }
+            this->applyKnobs(next);
+            return true;
+        }
+
+        // `applyKnobs()`
+        // Switches the tree to new knobs. A new page or buffer size flushes the buffer and replaces it
+        // with an empty one of the new size, and a new page size also rebuilds the fences, page
+        // tombstone counts, and page summaries of every run. Existing runs keep their size and bloom filters until they are
+        // rewritten by a merge. Levels pushed over their new capacity are compacted right away.
+        void applyKnobs(const Knobs& next) {
+            bool newPageSize = next.pageSize != this->knobs.pageSize;
+            bool newBuffer = newPageSize || next.bufferPages != this->knobs.bufferPages;
+            if (newBuffer) this->flushBuffer();
+            this->knobs = next;
+
+            if (newPageSize) {
+                for (size_t l = 0; l < this->getNumLevels(); l++) {
+                    for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                        size_t tombstonesSince = run->tombstonesSince;
+                        this->constructFence(run);
+                        this->constructPageTombstones(run);
+                        this->constructPageSummaries(run);
+                        run->tombstonesSince = tombstonesSince;
+                    }
+                }
+            }
+            if (newBuffer) {
+                Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+                this->getLevel(0)->runs[0] = this->createRun(this->getBufferSize(), this->bloomFpr(0));
+                this->deleteRun(buffer);
+            }
+            this->growLevels();
+            this->compactLevel(1);
+            if (this->levelFilter.overflowed()) this->rebuildLevelFilter();
+        }
+
+        // `tune()`
+        // Updates the tuner with the operations since the last call and records its recommendation.
+        // With TUNER_APPLY, the knobs are also moved one step towards it.
+        void tune(void) {
+            this->tuner.observe(this->stats);
+            size_t numEntries = 0;
+            for (size_t l = 0; l < this->getNumLevels(); l++) numEntries += this->getPairsInLevel(l);
+            this->recommendation = this->tuner.recommend(this->knobs, numEntries, sizeof(KeyType) + sizeof(ValType));
+            if (this->knobs.tunerMode == TUNER_APPLY) this->applyKnobs(Tuner::step(this->knobs, *this->recommendation));
         }
 
         // `put()`
@@ -190,26 +352,312 @@ class LSM {
         std::tuple<Status, std::string> put(Status status, KeyType key, ValType val, bool isDelete) {
             if (!isDelete) this->stats.puts++;
             else this->stats.deletes++;
-            this->appendPair(0, key, val, isDelete);
+            this->stats.bytesPut += valueBytes(key) + (isDelete ? 0 : valueBytes(val));
+            this->rowCache.erase(key);
+            this->appendToBuffer(key, val, isDelete, false);
+            return std::make_tuple(status, "");
+        }
+
+        // `add()`
+        // Adds `delta` to the value of a key (or appends it, for byte strings) without reading the value:
+        // an operand is written like a put, and applied to the older entries of the key when a read meets
+        // it or a merge brings them together, see `foldOperand()`. A key without a value takes `delta`.
+        std::tuple<Status, std::string> add(Status status, KeyType key, ValType delta) {
+            this->stats.adds++;
+            this->stats.bytesPut += valueBytes(key) + valueBytes(delta);
+            // A cached result takes the operand too, so a hot counter stays in the row cache.
+            if (const std::optional<ValType>* cached = this->rowCache.find(key)) {
+                this->rowCache.insert(key, foldOperand(cached->value_or(ValType()), delta));
+            }
+            this->appendToBuffer(key, delta, false, true);
+            return std::make_tuple(status, "");
+        }
+
+        // `appendToBuffer()`
+        // Appends an entry to the buffer, and flushes the buffer once it is full.
+        void appendToBuffer(const KeyType& key, const ValType& val, bool isDelete, bool isOperand) {
+            this->appendPair(this->getBuffer(), key, val, isDelete, isOperand);
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) this->levelFilter.add(bloomHash(key).h1, 0);
+            if (this->getBuffer()->numPairs == this->getBuffer()->capacity) this->flush();
+            if (this->levelFilter.overflowed()) this->rebuildLevelFilter();
+        }
+
+        // `flush()`
+        // Flushes the buffer, full or not, and runs the merges, value log garbage collection, and tuning
+        // that follow a flush. Called by writes that fill the buffer, and by `Keyspaces` to keep the
+        // buffers of several trees within a shared budget.
+        void flush(void) {
+            if (this->getBuffer()->numPairs == 0) return;
+            auto start = std::chrono::steady_clock::now();
+            size_t stalls = this->stats.compactionStalls;
+            this->compactionLimiter.refill();
+            this->flushBuffer();
+            this->compactTombstones();
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) this->collectValueLog();
+            if (this->knobs.tunerMode != TUNER_OFF && this->flushes % TUNER_INTERVAL == 0) this->tune();
+            this->compactionLimiter.observePause(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count(),
+                                                 this->stats.compactionStalls > stalls);
+        }
+
+        // `deleteRange()`
+        // Deletes every key in [leftBound, rightBound). Matching entries in the buffer are dropped
+        // immediately, and a range tombstone is recorded in the buffer to shadow the deeper levels.
+        // The range tombstone travels down with merges, dropping covered entries as it goes.
+        std::tuple<Status, std::string> deleteRange(Status status, KeyType leftBound, KeyType rightBound) {
+            if (!(leftBound < rightBound)) return std::make_tuple(status, "");
+            this->stats.rangeDeletes++;
+            this->rowCache.eraseRange(leftBound, rightBound);
+            RangeTombstones<KeyType> deleted;
+            deleted.add(leftBound, rightBound);
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+                for (size_t i = 0; i < buffer->numPairs; i++) {
+                    KeyType key = this->getKey(buffer, i);
+                    if (deleted.covers(key)) this->levelFilter.remove(bloomHash(key).h1, 0);
+                }
+            }
+            this->applyRangeTombstones(this->getBuffer(), deleted);
+            // With only the buffer present there is nothing older to shadow.
+            if (this->getNumLevels() > 1) {
+                this->getLevel(0)->rangeTombstones.add(leftBound, rightBound);
+                this->getLevel(0)->rangeTombstonesSince = std::min(this->getLevel(0)->rangeTombstonesSince, this->flushes);
+            }
             return std::make_tuple(status, "");
         }
 
         // `get()`
-        // Search the LSM tree for a key.
+        // Search the LSM tree for a key. Keys in the row cache are answered without searching, and the
+        // result of a search is added to it.
         std::tuple<Status, std::string> get(Status status, KeyType key) {
+            if constexpr (ROW_CACHE_ENTRIES > 0) {
+                if (const std::optional<ValType>* cached = this->rowCache.find(key)) {
+                    this->stats.rowCacheHits++;
+                    return this->getReply(status, *cached);
+                }
+                this->stats.rowCacheMisses++;
+            }
 
-            // Search through each level of the LSM tree.
+            // Search through each level of the LSM tree. With FILTER_CUCKOO only the levels the level
+            // filter names are searched.
+            std::optional<ValType> val;
+            uint32_t candidates = ~0u;
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) candidates = this->levelFilter.levels(bloomHash(key).h1);
             for (size_t l = 0; l < this->getNumLevels(); l++) {
-                int i = this->searchLevel(l, key, false);
-                if (i >= 0) {
-                    if (this->getTomb(l, i)) break;
-                    this->stats.successfulGets++;
-                    return std::make_tuple(status, std::to_string(this->getVal(l, i)));
+                if (candidates >> std::min(l, LevelFilter::MAX_LEVEL) & 1) {
+                    Run<KeyType, ValType, DictValType, PolicyType>* run = this->findRun(l, key);
+                    // `searchRun()` counts a bloom filter positive whenever it reads a page of the run.
+                    size_t positives = this->stats.bloomTruePositives + this->stats.bloomFalsePositives;
+                    int i = run == nullptr ? -1 : this->searchRun(run, key, false);
+                    if (l > 0 && this->stats.bloomTruePositives + this->stats.bloomFalsePositives != positives) this->stats.level(l).pageReads++;
+                    if (i >= 0) {
+                        val = this->resolveEntry(key, l, run, i);
+                        break;
+                    }
+                } else {
+                    this->stats.searchLevelCalls++;
                 }
+                // The key is not in this level, so a range tombstone here hides any older version.
+                if (this->getLevel(l)->rangeTombstones.covers(key)) break;
             }
 
-            this->stats.failedGets++;
-            return std::make_tuple(status, "");
+            this->rowCache.insert(key, val);
+            return this->getReply(status, val);
+        }
+
+        // `resolveEntry()`
+        // Returns the value that entry i of a run in level l gives its key: nothing for a tombstone, and
+        // for an operand, the operand applied to the value of the older entries, which are looked up
+        // down to the first put, tombstone, or range tombstone.
+        std::optional<ValType> resolveEntry(const KeyType& key, size_t l, Run<KeyType, ValType, DictValType, PolicyType>* run, size_t i) {
+            if (this->getTomb(run, i)) return std::nullopt;
+            ValType val = this->getVal(run, i);
+            while (this->getOperand(run, i)) {
+                std::tie(l, run, i) = this->findOlder(key, l, i);
+                if (run == nullptr || this->getTomb(run, i)) break;
+                val = foldOperand(this->getVal(run, i), val);
+            }
+            return val;
+        }
+
+        // `getReply()`
+        // Counts a get that found `val`, or nothing, and returns its reply.
+        std::tuple<Status, std::string> getReply(Status status, const std::optional<ValType>& val) {
+            if (!val) {
+                this->stats.failedGets++;
+                return std::make_tuple(status, "");
+            }
+            this->stats.successfulGets++;
+            return std::make_tuple(status, valueToString(*val));
+        }
+
+        // `multiGet()`
+        // Looks up a batch of keys and returns the same replies as calling `get()` on each of them.
+        // Keys in the row cache are answered up front, and the results of the others are cached.
+        // Up to GET_BATCH_WIDTH lookups are in flight at once, each a small state machine that walks
+        // the levels like `get()`. Every step that is about to touch memory that is likely cold (the
+        // bloom filter words or level filter buckets, the next probe of the binary search in a page,
+        // the tombstone and value of a match) prefetches it and yields to the next lookup, so the
+        // misses of the lookups overlap instead of stalling one after another.
+        std::vector<std::tuple<Status, std::string>> multiGet(Status status, const std::vector<KeyType>& keys) {
+            enum Step { PROBE_LEVELS, FIND_RUN, PROBE_FILTER, SEARCH_PAGE, READ_ENTRY };
+            struct Lookup {
+                size_t index;
+                BloomHash hash;
+                size_t level = 0;
+                Step step = FIND_RUN;
+                // With FILTER_CUCKOO, the levels the level filter names.
+                uint32_t candidates = ~0u;
+                Run<KeyType, ValType, DictValType, PolicyType>* run = nullptr;
+                // The bounds of the binary search in the page, then the index of the match.
+                int l = 0, r = -1;
+            };
+            std::vector<std::tuple<Status, std::string>> replies(keys.size(), std::make_tuple(status, ""));
+
+            // `missLevel()` moves a lookup on to the next level. Returns true once the key is known to be absent.
+            auto missLevel = [this, &keys](Lookup& lookup) {
+                if (this->getLevel(lookup.level)->rangeTombstones.covers(keys[lookup.index]) || ++lookup.level == this->getNumLevels()) {
+                    this->stats.failedGets++;
+                    this->rowCache.insert(keys[lookup.index], std::nullopt);
+                    return true;
+                }
+                lookup.step = FIND_RUN;
+                return false;
+            };
+            // `readPage()` accounts for a bloom filter positive, matching `searchRun()` and `get()`.
+            auto readPage = [this](Lookup& lookup, bool found) {
+                if (found) this->stats.bloomTruePositives++;
+                else this->stats.bloomFalsePositives++;
+                if (lookup.level > 0) this->stats.level(lookup.level).pageReads++;
+            };
+            auto found = [this, &readPage](Lookup& lookup, int i) {
+                readPage(lookup, true);
+                lookup.l = i;
+                __builtin_prefetch(this->getRunTombstone(lookup.run) + i / 64);
+                lookup.run->vals.prefetch(i);
+                lookup.step = READ_ENTRY;
+            };
+
+            // `step()` runs the next step of a lookup. Returns true once its reply is known.
+            auto step = [&](Lookup& lookup) {
+                const KeyType& key = keys[lookup.index];
+                Run<KeyType, ValType, DictValType, PolicyType>* run = lookup.run;
+                switch (lookup.step) {
+                    case PROBE_LEVELS:
+                        lookup.candidates = this->levelFilter.levels(lookup.hash.h1);
+                        lookup.step = FIND_RUN;
+                        return false;
+
+                    case FIND_RUN:
+                        if (!(lookup.candidates >> std::min(lookup.level, LevelFilter::MAX_LEVEL) & 1)) {
+                            this->stats.searchLevelCalls++;
+                            return missLevel(lookup);
+                        }
+                        lookup.run = this->findRun(lookup.level, key);
+                        if (lookup.run == nullptr) return missLevel(lookup);
+                        this->stats.searchLevelCalls++;
+                        if (lookup.run->numPairs == 0) return missLevel(lookup);
+                        if constexpr (PolicyType::filter == FILTER_BLOOM) lookup.run->bloomFilter->prefetch(lookup.hash);
+                        lookup.step = PROBE_FILTER;
+                        return false;
+
+                    case PROBE_FILTER: {
+                        if constexpr (PolicyType::filter == FILTER_BLOOM) {
+                            if (!run->bloomFilter->mayContain(lookup.hash)) return missLevel(lookup);
+                        }
+                        if (run == this->getBuffer()) {
+                            // The buffer is small and recently written, so it is scanned in one step.
+                            for (int i = run->numPairs - 1; i >= 0; i--) {
+                                if (this->getKey(run, i) == key) {
+                                    found(lookup, i);
+                                    return false;
+                                }
+                            }
+                            readPage(lookup, false);
+                            return missLevel(lookup);
+                        }
+                        int pageIndex = this->searchFence(run, key);
+                        if (pageIndex == -1) {
+                            readPage(lookup, false);
+                            return missLevel(lookup);
+                        }
+                        lookup.l = pageIndex * this->getPageSize();
+                        lookup.r = std::min<int>((pageIndex + 1) * this->getPageSize(), run->numPairs - 1);
+                        run->keys.prefetch((lookup.l + lookup.r) / 2);
+                        lookup.step = SEARCH_PAGE;
+                        return false;
+                    }
+
+                    case SEARCH_PAGE: {
+                        // One probe of the binary search in `searchRun()`.
+                        int m = (lookup.l + lookup.r) / 2;
+                        KeyType probe = this->getKey(run, m);
+                        if (probe == key) {
+                            found(lookup, m);
+                            return false;
+                        }
+                        if (probe < key) lookup.l = m + 1;
+                        else lookup.r = m - 1;
+                        if (lookup.l > lookup.r) {
+                            readPage(lookup, false);
+                            return missLevel(lookup);
+                        }
+                        run->keys.prefetch((lookup.l + lookup.r) / 2);
+                        return false;
+                    }
+
+                    case READ_ENTRY: {
+                        std::optional<ValType> val = this->resolveEntry(key, lookup.level, run, lookup.l);
+                        this->rowCache.insert(key, val);
+                        replies[lookup.index] = this->getReply(status, val);
+                        return true;
+                    }
+                }
+                return true;
+            };
+
+            // The key is hashed once for the bloom filters of every level, or for the level filter.
+            auto start = [this, &keys](size_t index) {
+                Lookup lookup{index, {}};
+                if constexpr (PolicyType::filter != FILTER_NONE) lookup.hash = bloomHash(keys[index]);
+                if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                    this->levelFilter.prefetch(lookup.hash.h1);
+                    lookup.step = PROBE_LEVELS;
+                }
+                return lookup;
+            };
+
+            // Keys in the row cache are answered right away, and the others are left to look up.
+            std::vector<size_t> pending;
+            pending.reserve(keys.size());
+            for (size_t index = 0; index < keys.size(); index++) {
+                if constexpr (ROW_CACHE_ENTRIES > 0) {
+                    if (const std::optional<ValType>* val = this->rowCache.find(keys[index])) {
+                        this->stats.rowCacheHits++;
+                        replies[index] = this->getReply(status, *val);
+                        continue;
+                    }
+                    this->stats.rowCacheMisses++;
+                }
+                pending.push_back(index);
+            }
+
+            // Step the lookups in flight round-robin, starting a new one whenever one finishes.
+            std::vector<Lookup> inFlight;
+            size_t next = 0;
+            for (; next < pending.size() && inFlight.size() < GET_BATCH_WIDTH; next++) inFlight.push_back(start(pending[next]));
+            while (!inFlight.empty()) {
+                for (size_t i = 0; i < inFlight.size(); ) {
+                    if (!step(inFlight[i])) {
+                        i++;
+                    } else if (next < pending.size()) {
+                        inFlight[i++] = start(pending[next++]);
+                    } else {
+                        inFlight[i] = inFlight.back();
+                        inFlight.pop_back();
+                    }
+                }
+            }
+            return replies;
         }
 
         // `range()`
@@ -219,32 +667,113 @@ class LSM {
             this->stats.ranges++;
 
             std::map<KeyType, ValType> results;
+            this->collectRange(leftBound, rightBound, results, true);
+
+            std::cout << "Range query bounds: [" << leftBound << ", " << rightBound << "], Range query size: " << results.size() << std::endl;
+            this->stats.rangeLengthSum += results.size();
+            if constexpr (std::is_arithmetic_v<ValType>) {
+                if (TESTING_SWITCH == TESTING_ON) {
+                    for (const auto& pair : results) {
+                        this->stats.rangeValueSum = (this->stats.rangeValueSum + pair.second) % static_cast<int64_t>(std::pow(10, 6));
+                    }
+                }
+            }
+            return std::make_tuple(status, mapToString(results));
+        }
+
+        // `collectRange()`
+        // Adds the live KV pairs with keys in [leftBound, rightBound) to `results`. If `verbose` is
+        // set, the time spent searching and scanning each level is logged. With VLOG encoding only the
+        // values of the live pairs are read from the value log.
+        void collectRange(KeyType leftBound, KeyType rightBound, std::map<KeyType, ValType>& results, bool verbose) {
+            std::map<KeyType, ValType> folded;
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                std::map<KeyType, EntryValType> pointers;
+                this->collectEntries(leftBound, rightBound, pointers, folded, verbose);
+                for (const auto& [key, pointer] : pointers) {
+                    auto it = folded.empty() ? folded.end() : folded.find(key);
+                    results.emplace_hint(results.end(), key, it != folded.end() ? it->second : this->valueLog.read(pointer));
+                }
+            } else {
+                this->collectEntries(leftBound, rightBound, results, folded, verbose);
+                for (const auto& [key, val] : folded) results[key] = val;
+            }
+        }
+
+        // `collectEntries()`
+        // Does the work of `collectRange()`, gathering the values as `Entry` carries them. The keys whose
+        // newest entry is an operand also get their value, the operands applied to the older value, in
+        // `folded`.
+        void collectEntries(KeyType leftBound, KeyType rightBound, std::map<KeyType, EntryValType>& results,
+                            std::map<KeyType, ValType>& folded, bool verbose) {
+            // `take()` makes entry i of a run the newest entry of its key so far.
+            auto take = [&](Run<KeyType, ValType, DictValType, PolicyType>* run, size_t i) {
+                KeyType key = this->getKey(run, i);
+                if (this->pageHasTombstones(run, i / this->getPageSize()) && this->getTomb(run, i)) {
+                    results.erase(key);
+                    if (!folded.empty()) folded.erase(key);
+                    return;
+                }
+                if (this->getOperand(run, i)) {
+                    auto older = folded.find(key);
+                    if (older != folded.end()) {
+                        older->second = foldOperand(older->second, this->getVal(run, i));
+                    } else {
+                        auto it = results.find(key);
+                        folded[key] = foldOperand(it != results.end() ? this->readEntryVal(it->second) : ValType(), this->getVal(run, i));
+                    }
+                } else if (!folded.empty()) {
+                    folded.erase(key);
+                }
+                results[key] = this->getEntryVal(run, i);
+            };
 
             // A range query must search through every level of the LSM tree. We iterate in reverse so that
             // only the most recent duplicate KV pair is retrieved in the case of duplicate entries.
             for (int l = this->getNumLevels() - 1; l >= 0; l--) {
+                // Range tombstones in this level delete the results gathered from the deeper levels.
+                for (const auto& range : this->getLevel(l)->rangeTombstones) {
+                    if (!(range.first < rightBound) || !(leftBound < range.second)) continue;
+                    results.erase(results.lower_bound(range.first), results.lower_bound(range.second));
+                    folded.erase(folded.lower_bound(range.first), folded.lower_bound(range.second));
+                }
+
                 if (l == 0) {
-                    for (size_t i = 0; i < this->getPairsInLevel(0); i++) {
-                        if ((leftBound <= this->getKey(l, i)) && (this->getKey(l, i) < rightBound)) {
-                            results[this->getKey(l, i)] = this->getVal(l, i);
-                            if (this->getTomb(l, i)) results.erase(this->getKey(l, i));
-                        }
+                    Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+                    if (!this->searchRangeFilter(buffer, leftBound, rightBound)) {
+                        this->stats.level(0).rangeFilterSkips++;
+                        continue;
+                    }
+                    for (size_t i = 0; i < buffer->numPairs; i++) {
+                        if ((leftBound <= this->getKey(buffer, i)) && (this->getKey(buffer, i) < rightBound)) take(buffer, i);
                     }
                 } else {
-                    auto startSearch = std::chrono::high_resolution_clock::now();
-                    int startIndex = this->searchLevel(l, leftBound, true);
-                    int endIndex = this->searchLevel(l, rightBound, true);
-                    auto endSearch = std::chrono::high_resolution_clock::now();
-                    auto durationSearch = std::chrono::duration_cast<std::chrono::microseconds>(endSearch - startSearch);
-
-                    auto startRange = std::chrono::high_resolution_clock::now();
-                    for (int i = startIndex; i < endIndex; i++) {
-                        results[this->getKey(l, i)] = this->getVal(l, i);
-                        if (this->getTomb(l, i)) results.erase(this->getKey(l, i));
+                    // Only the runs overlapping [leftBound, rightBound) whose range filters may hold a key in it
+                    // are searched.
+                    std::chrono::microseconds durationSearch(0), durationRange(0);
+                    const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+                    for (size_t r = this->findRunIndex(l, leftBound); r < runs.size() && this->getKey(runs[r], 0) < rightBound; r++) {
+                        Run<KeyType, ValType, DictValType, PolicyType>* run = runs[r];
+                        if (!this->searchRangeFilter(run, leftBound, rightBound)) {
+                            this->stats.level(l).rangeFilterSkips++;
+                            continue;
+                        }
+                        auto startSearch = std::chrono::high_resolution_clock::now();
+                        int startIndex = this->searchRun(run, leftBound, true);
+                        int endIndex = this->searchRun(run, rightBound, true);
+                        size_t pageSize = this->getPageSize();
+                        this->stats.level(l).pageReads += endIndex > startIndex ? (endIndex - 1) / pageSize - startIndex / pageSize + 1 : 1;
+                        auto endSearch = std::chrono::high_resolution_clock::now();
+                        durationSearch += std::chrono::duration_cast<std::chrono::microseconds>(endSearch - startSearch);
+
+                        // Pages without tombstones are copied straight into the results.
+                        auto startRange = std::chrono::high_resolution_clock::now();
+                        for (int i = startIndex; i < endIndex; i++) take(run, i);
+                        auto endRange = std::chrono::high_resolution_clock::now();
+                        durationRange += std::chrono::duration_cast<std::chrono::microseconds>(endRange - startRange);
                     }
-                    auto endRange = std::chrono::high_resolution_clock::now();
-                    auto durationRange = std::chrono::duration_cast<std::chrono::microseconds>(endRange - startRange);
 
+                    if (!verbose) continue;
                     std::ofstream logfile("logfile.txt", std::ios::app);
                     if (logfile.is_open()) {
                         logfile << "Search time: " << durationSearch.count() << " microseconds." << std::endl;
@@ -255,15 +784,278 @@ class LSM {
                     }
                 }
             }
+        }
 
-            std::cout << "Range query bounds: [" << leftBound << ", " << rightBound << "], Range query size: " << results.size() << std::endl;
-            this->stats.rangeLengthSum += results.size();
-            if (TESTING_SWITCH == TESTING_ON) {
-                for (const auto& pair : results) {
-                    this->stats.rangeValueSum = (this->stats.rangeValueSum + pair.second) % static_cast<ValType>(std::pow(10, 6));
+        // `aggregateRange()`
+        // Returns the COUNT, SUM, MIN, and MAX of the live values with keys in [leftBound, rightBound)
+        // without collecting them. Levels are visited from newest to oldest. A page lying wholly inside
+        // the range is answered from its summary, less the entries shadowed by keys already seen in
+        // newer levels, which are looked up on the page. The page is scanned instead if a newer range
+        // tombstone overlaps it, or if a shadowed entry holds its MIN or MAX. Boundary pages, the buffer,
+        // and runs holding operands are scanned, skipping the entries that something newer shadows.
+        Aggregate<ValType> aggregateRange(KeyType leftBound, KeyType rightBound) {
+            Aggregate<ValType> total;
+            if (!(leftBound < rightBound)) return total;
+
+            // The newest version of each key scanned so far, or nothing for a tombstone.
+            std::map<KeyType, std::optional<ValType>> scanned;
+            // The pages answered from their summaries, by level and first key.
+            struct SummarizedPage {
+                KeyType last;
+                Run<KeyType, ValType, DictValType, PolicyType>* run;
+                size_t page;
+            };
+            std::vector<std::map<KeyType, SummarizedPage>> summarized(this->getNumLevels());
+            // The range tombstones of the levels visited so far, which delete entries in deeper levels.
+            RangeTombstones<KeyType> deleted;
+
+            // Returns whether an entry for `key` in level l is shadowed by a newer entry or range tombstone.
+            auto shadowed = [&](const KeyType& key, size_t l) {
+                if (scanned.count(key) > 0 || deleted.covers(key)) return true;
+                for (size_t j = 1; j < l; j++) {
+                    auto it = summarized[j].upper_bound(key);
+                    if (it == summarized[j].begin()) continue;
+                    --it;
+                    if (!(it->second.last < key) && this->pageContains(it->second.run, it->second.page, key)) return true;
+                }
+                return false;
+            };
+            // Fills `keys` with the keys in [first, last] that have an entry newer than level l, in order.
+            std::vector<KeyType> keys;
+            auto newerKeys = [&](const KeyType& first, const KeyType& last, size_t l) {
+                keys.clear();
+                for (auto it = scanned.lower_bound(first); it != scanned.end() && !(last < it->first); ++it) keys.push_back(it->first);
+                bool sorted = true;
+                for (size_t j = 1; j < l; j++) {
+                    auto it = summarized[j].upper_bound(first);
+                    if (it != summarized[j].begin()) --it;
+                    for (; it != summarized[j].end() && !(last < it->first); ++it) {
+                        if (it->second.last < first) continue;
+                        Run<KeyType, ValType, DictValType, PolicyType>* run = it->second.run;
+                        size_t end = std::min((it->second.page + 1) * this->getPageSize(), run->numPairs);
+                        for (size_t i = this->pageLowerBound(run, it->second.page, first); i < end && !(last < this->getKey(run, i)); i++) {
+                            keys.push_back(this->getKey(run, i));
+                            sorted = false;
+                        }
+                    }
+                }
+                if (!sorted) {
+                    std::sort(keys.begin(), keys.end());
+                    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+                }
+            };
+            // Returns the summary of a whole page less its shadowed entries, or nothing if they cannot be
+            // taken out.
+            auto summarize = [&](Run<KeyType, ValType, DictValType, PolicyType>* run, size_t page, const KeyType& first, const KeyType& last, size_t l) {
+                Aggregate<ValType> summary = page < run->pageSummaries.size() ? run->pageSummaries[page] : Aggregate<ValType>();
+                newerKeys(first, last, l);
+                size_t end = std::min((page + 1) * this->getPageSize(), run->numPairs);
+                for (const KeyType& key : keys) {
+                    size_t i = this->pageLowerBound(run, page, key);
+                    if (i == end || !(this->getKey(run, i) == key) || this->getTomb(run, i)) continue;
+                    if (!summary.remove(this->getVal(run, i))) return std::optional<Aggregate<ValType>>();
+                }
+                return std::optional<Aggregate<ValType>>(summary);
+            };
+
+            for (size_t l = 0; l < this->getNumLevels(); l++) {
+                if (l == 0) {
+                    // The buffer is unsorted, so it is scanned newest entry first.
+                    Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+                    if (this->searchRangeFilter(buffer, leftBound, rightBound)) {
+                        for (size_t i = buffer->numPairs; i-- > 0; ) {
+                            KeyType key = this->getKey(buffer, i);
+                            if (key < leftBound || !(key < rightBound) || scanned.count(key) > 0) continue;
+                            scanned.emplace(key, this->resolveEntry(key, 0, buffer, i));
+                        }
+                    } else {
+                        this->stats.level(0).rangeFilterSkips++;
+                    }
+                } else {
+                    size_t pageSize = this->getPageSize();
+                    const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+                    for (size_t r = this->findRunIndex(l, leftBound); r < runs.size() && this->getKey(runs[r], 0) < rightBound; r++) {
+                        Run<KeyType, ValType, DictValType, PolicyType>* run = runs[r];
+                        if (!this->searchRangeFilter(run, leftBound, rightBound)) {
+                            this->stats.level(l).rangeFilterSkips++;
+                            continue;
+                        }
+                        size_t startIndex = std::max(0, this->searchRun(run, leftBound, true));
+                        size_t endIndex = std::max(0, this->searchRun(run, rightBound, true));
+                        for (size_t p = startIndex / pageSize; p * pageSize < endIndex; p++) {
+                            size_t first = std::max(p * pageSize, startIndex), last = std::min((p + 1) * pageSize, endIndex);
+                            if constexpr (PolicyType::encoding != ENCODING_VLOG) {
+                                KeyType firstKey = this->getKey(run, first), lastKey = this->getKey(run, last - 1);
+                                bool whole = first == p * pageSize && last == std::min((p + 1) * pageSize, run->numPairs);
+                                if (whole && run->numOperands == 0 && !deleted.overlaps(firstKey, lastKey)) {
+                                    if (std::optional<Aggregate<ValType>> summary = summarize(run, p, firstKey, lastKey, l)) {
+                                        total += *summary;
+                                        summarized[l].emplace(firstKey, SummarizedPage{lastKey, run, p});
+                                        this->stats.level(l).pagesSummarized++;
+                                        continue;
+                                    }
+                                }
+                            }
+                            this->stats.level(l).pageReads++;
+                            for (size_t i = first; i < last; i++) {
+                                KeyType key = this->getKey(run, i);
+                                if (shadowed(key, l)) continue;
+                                scanned.emplace(key, this->resolveEntry(key, l, run, i));
+                            }
+                        }
+                    }
+                }
+                for (const auto& range : this->getLevel(l)->rangeTombstones) {
+                    if (range.first < rightBound && leftBound < range.second) deleted.add(range.first, range.second);
                 }
             }
-            return std::make_tuple(status, mapToString(results));
+
+            for (const auto& [key, val] : scanned) {
+                if (val) total.add(*val);
+            }
+            return total;
+        }
+
+        // `scanRange()`
+        // Returns the first `limit` live pairs with keys in [leftBound, rightBound), in descending key
+        // order if `reverse` is set. The levels are merged lazily, one cursor per level with the newest
+        // entry winning each key, so the scan stops reading once it has `limit` pairs instead of
+        // collecting the whole range. Runs are only searched when their cursor reaches them.
+        std::vector<std::pair<KeyType, ValType>> scanRange(KeyType leftBound, KeyType rightBound, size_t limit, bool reverse) {
+            std::vector<std::pair<KeyType, ValType>> results;
+            if (!(leftBound < rightBound) || limit == 0) return results;
+
+            // The entry under a level's cursor, and for levels beneath the buffer the run it is in and
+            // that run's entries within the range, [begin, end). `run` is null once the level is done.
+            struct Cursor {
+                Run<KeyType, ValType, DictValType, PolicyType>* run = nullptr;
+                size_t index = 0;
+                size_t r = 0, begin = 0, end = 0;
+                size_t page = std::numeric_limits<size_t>::max();
+            };
+            size_t numLevels = this->getNumLevels(), pageSize = this->getPageSize();
+            std::vector<Cursor> cursors(numLevels);
+
+            // The buffer's entries in the range form a heap whose top is the next key in scan order, newest
+            // entry first, so only the entries that are reached get sorted.
+            Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+            std::vector<std::pair<KeyType, size_t>> bufferHeap;
+            auto after = [reverse](const std::pair<KeyType, size_t>& a, const std::pair<KeyType, size_t>& b) {
+                if (a.first == b.first) return a.second < b.second;
+                return reverse ? a.first < b.first : b.first < a.first;
+            };
+            if (this->searchRangeFilter(buffer, leftBound, rightBound)) {
+                for (size_t i = 0; i < buffer->numPairs; i++) {
+                    KeyType key = this->getKey(buffer, i);
+                    if (!(key < leftBound) && key < rightBound) bufferHeap.emplace_back(key, i);
+                }
+                std::make_heap(bufferHeap.begin(), bufferHeap.end(), after);
+                if (!bufferHeap.empty()) {
+                    cursors[0].run = buffer;
+                    cursors[0].index = bufferHeap.front().second;
+                }
+            } else {
+                this->stats.level(0).rangeFilterSkips++;
+            }
+
+            // Counts a page read whenever the cursor of a level beneath the buffer moves onto a new page.
+            auto touch = [&](size_t l) {
+                size_t page = cursors[l].index / pageSize;
+                if (page != cursors[l].page) this->stats.level(l).pageReads++;
+                cursors[l].page = page;
+            };
+            // Moves the cursor of level l to the first entry in the range of its run, or of the next run in
+            // scan order that has one.
+            auto seek = [&](size_t l) {
+                Cursor& cursor = cursors[l];
+                const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+                for (; cursor.r < runs.size(); cursor.r = reverse ? cursor.r - 1 : cursor.r + 1) {
+                    Run<KeyType, ValType, DictValType, PolicyType>* run = runs[cursor.r];
+                    if (run->numPairs == 0) continue;
+                    if (reverse ? this->getKey(run, run->numPairs - 1) < leftBound : !(this->getKey(run, 0) < rightBound)) break;
+                    if (!this->searchRangeFilter(run, leftBound, rightBound)) {
+                        this->stats.level(l).rangeFilterSkips++;
+                        continue;
+                    }
+                    int begin = this->searchRun(run, leftBound, true), end = this->searchRun(run, rightBound, true);
+                    if (0 <= begin && begin < end) {
+                        cursor.run = run;
+                        cursor.begin = begin;
+                        cursor.end = end;
+                        cursor.index = reverse ? end - 1 : begin;
+                        touch(l);
+                        return;
+                    }
+                }
+                cursor.run = nullptr;
+            };
+            // Moves the cursor of level l past the entry under it.
+            auto advance = [&](size_t l) {
+                Cursor& cursor = cursors[l];
+                if (l == 0) {
+                    KeyType key = bufferHeap.front().first;
+                    while (!bufferHeap.empty() && bufferHeap.front().first == key) {
+                        std::pop_heap(bufferHeap.begin(), bufferHeap.end(), after);
+                        bufferHeap.pop_back();
+                    }
+                    if (bufferHeap.empty()) cursor.run = nullptr;
+                    else cursor.index = bufferHeap.front().second;
+                } else if (reverse ? cursor.index > cursor.begin : cursor.index + 1 < cursor.end) {
+                    cursor.index = reverse ? cursor.index - 1 : cursor.index + 1;
+                    touch(l);
+                } else {
+                    cursor.r = reverse ? cursor.r - 1 : cursor.r + 1;
+                    seek(l);
+                }
+            };
+            for (size_t l = 1; l < numLevels; l++) {
+                cursors[l].r = this->findRunIndex(l, reverse ? rightBound : leftBound);
+                seek(l);
+            }
+
+            while (results.size() < limit) {
+                // The next key is the smallest (or largest) under any cursor. Ties go to the newest level.
+                std::optional<size_t> newest;
+                KeyType key = KeyType();
+                for (size_t l = 0; l < numLevels; l++) {
+                    if (cursors[l].run == nullptr) continue;
+                    KeyType candidate = this->getKey(cursors[l].run, cursors[l].index);
+                    if (!newest || (reverse ? key < candidate : candidate < key)) {
+                        newest = l;
+                        key = candidate;
+                    }
+                }
+                if (!newest) break;
+
+                Run<KeyType, ValType, DictValType, PolicyType>* run = cursors[*newest].run;
+                size_t i = cursors[*newest].index;
+                bool live = !this->getTomb(run, i);
+                for (size_t l = 0; l < *newest && live; l++) {
+                    if (this->getLevel(l)->rangeTombstones.covers(key)) live = false;
+                }
+                if (live) results.emplace_back(key, *this->resolveEntry(key, *newest, run, i));
+                for (size_t l = *newest; l < numLevels; l++) {
+                    if (cursors[l].run != nullptr && this->getKey(cursors[l].run, cursors[l].index) == key) advance(l);
+                }
+            }
+            return results;
+        }
+
+        // `limitRange()`
+        // Answers a range query with a limit, see `scanRange()`. The reply ends with a continuation token
+        // if there are more pairs in the range, see `pageToString()`.
+        std::tuple<Status, std::string> limitRange(Status status, KeyType leftBound, KeyType rightBound, size_t limit, bool reverse) {
+            this->stats.ranges++;
+            std::vector<std::pair<KeyType, ValType>> results = this->scanRange(leftBound, rightBound, limit + 1, reverse);
+            this->stats.rangeLengthSum += std::min(results.size(), limit);
+            return std::make_tuple(status, pageToString(results, limit, reverse));
+        }
+
+        // `rangeAggregate()`
+        // Answers an aggregate range query.
+        std::tuple<Status, std::string> rangeAggregate(Status status, KeyType leftBound, KeyType rightBound) {
+            this->stats.rangeAggregates++;
+            return std::make_tuple(status, aggregateToString(this->aggregateRange(leftBound, rightBound)));
         }
 
         void printLevels(std::string userCommand) {
@@ -278,26 +1070,39 @@ class LSM {
 
                 std::cout << "Contains: " << this->getPairsInLevel(l) << " KV pairs = " << this->getPairsInLevel(l) * (sizeof(KeyType) + sizeof(ValType)) << " bytes." << std::endl;
                 std::cout << "Unique keys: " << this->getUniqueKeyCount(l) << ". Unique values: " << this->getUniqueValCount(l) << std::endl;
-                std::cout << "Capacity: " << this->getLevelCapacity(l) << " KV pairs = " << this->getLevelCapacity(l) * (sizeof(KeyType) + sizeof(ValType)) << " bytes." << std::endl;
+                if (this->getLevelCapacity(l) == std::numeric_limits<size_t>::max()) std::cout << "Capacity: unbounded (last level)." << std::endl;
+                else std::cout << "Capacity: " << this->getLevelCapacity(l) << " KV pairs = " << this->getLevelCapacity(l) * (sizeof(KeyType) + sizeof(ValType)) << " bytes." << std::endl;
+                std::cout << "Runs: " << this->getLevel(l)->runs.size() << std::endl;
+                size_t numOperands = 0;
+                for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) numOperands += run->numOperands;
+                std::cout << "Tombstones: " << this->getTombstonesInLevel(l) << ". Operands: " << numOperands << ". Range tombstones: " << this->getLevel(l)->rangeTombstones.size() << std::endl;
 
                 if (userCommand == "pv") {
                     // Verbose printing.
-                    if (l == 0) {
-                        std::cout << "Buffer is unsorted. No fence pointers." << std::endl;
-                    } else if (!this->levelIsEmpty(l)) {
-                        std::cout << "Fence: [";
-                        for (size_t i = 0; i < this->getFenceLength(l) - 1; i++) {
-                            std::cout << this->getFenceKey(l, i) << ", ";
+                    for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                        std::cout << "Run " << run->id << ": " << run->numPairs << " KV pairs." << std::endl;
+                        if (l == 0) {
+                            std::cout << "Buffer is unsorted. No fence pointers." << std::endl;
+                        } else if (run->numPairs > 0) {
+                            std::cout << "Fence: [";
+                            for (size_t i = 0; i < run->fenceLength - 1; i++) {
+                                std::cout << this->getFenceKey(run, i) << ", ";
+                            }
+                            std::cout << this->getFenceKey(run, run->fenceLength - 1) << "]" << std::endl;
+                        }
+                        if constexpr (PolicyType::filter == FILTER_BLOOM) {
+                            std::cout << "Bloom: [";
+                            for (size_t i = 0; i < run->bloomFilter->numBits() - 1; i++) {
+                                std::cout << run->bloomFilter->getBit(i) << ", ";
+                            }
+                            std::cout << run->bloomFilter->getBit(run->bloomFilter->numBits() - 1) << "]" << std::endl;
+                        }
+                        for (size_t i = 0; i < run->numPairs; i++) {
+                            std::cout << this->getKey(run, i) << " -> " << this->getVal(run, i) << "  " << this->getTomb(run, i) << std::endl;
                         }
-                        std::cout << this->getFenceKey(l, this->getFenceLength(l) - 1) << "]" << std::endl;
-                    }
-                    std::cout << "Bloom: [";
-                    for (size_t i = 0; i < this->getBloomFilter(l)->numBits() - 1; i++) {
-                        std::cout << this->getBloomFilter(l)->getBit(i) << ", ";
                     }
-                    std::cout << this->getBloomFilter(l)->getBit(this->getBloomFilter(l)->numBits() - 1) << "]" << std::endl;
-                    for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                        std::cout << this->getKey(l, i) << " -> " << this->getVal(l, i) << "  " << this->getTomb(l, i) << std::endl;
+                    for (const auto& range : this->getLevel(l)->rangeTombstones) {
+                        std::cout << "Deleted range: [" << range.first << ", " << range.second << ")" << std::endl;
                     }
                 }
             }
@@ -319,18 +1124,38 @@ class LSM {
 
             // Tokenize the command.
             std::vector<std::string> tokens = parseCommand(userCommand);
+            if (tokens.empty()) return std::make_tuple(ERROR, "Empty command.");
+            KeyType key, rightBound;
+            ValType val;
+            size_t limit;
+            bool reverse;
+
+            if (tokens[0] == "stats" && (tokens.size() == 1 || (tokens.size() == 2 && tokens[1] == "json"))) {
+                return std::make_tuple(status, statsToString(this->getStats(), tokens.size() == 2));
+            }
+
+            if (tokens[0] == "k" && (tokens.size() == 1 || tokens.size() == 3)) {
+                if (tokens.size() == 3 && !this->setKnob(tokens[1], tokens[2])) {
+                    return std::make_tuple(ERROR, "Unknown knob or invalid value: " + tokens[1] + " " + tokens[2]);
+                }
+                std::string reply = "Knobs: " + knobsToString(this->knobs);
+                if (this->recommendation) reply += "\nTuner recommends: " + knobsToString(*this->recommendation);
+                return std::make_tuple(status, reply);
+            }
 
             // Check that the input command is valid, and proceed with routing if so.
-            if (tokens[0] == "p" && tokens.size() == 3 && isNum(tokens[1]) && isNum(tokens[2])) {
+            if (tokens[0] == "p" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], val)) {
                 // std::cout << "Received put command.\n" <<  std::endl;
-                return put(status, std::stoi(tokens[1]), std::stoi(tokens[2]), false);
-            } else if (tokens[0] == "g" && tokens.size() == 2 && isNum(tokens[1])) {
+                return put(status, key, val, false);
+            } else if (tokens[0] == "a" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], val)) {
+                return add(status, key, val);
+            } else if (tokens[0] == "g" && tokens.size() == 2 && parseToken(tokens[1], key)) {
                 // std::cout << "Received  get command.\n" << std::endl;
-                return get(status, std::stoi(tokens[1]));
-            } else if (tokens[0] == "r" && tokens.size() == 3 && isNum(tokens[1]) && isNum(tokens[2])) {
+                return get(status, key);
+            } else if (tokens[0] == "r" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
                 // std::cout << "Received range query command.\n" <<  std::endl;
                 auto start = std::chrono::high_resolution_clock::now();
-                auto res = range(status, std::stoi(tokens[1]), std::stoi(tokens[2]));
+                auto res = range(status, key, rightBound);
                 auto end = std::chrono::high_resolution_clock::now();
                 auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
                 std::ofstream logfile("logfile.txt", std::ios::app);
@@ -341,15 +1166,32 @@ class LSM {
                     std::cout << "Failed to open log file." << std::endl;
                 }
                 return res;
-            } else if (tokens[0] == "d" && tokens.size() == 2 && isNum(tokens[1])) {
+            } else if (tokens[0] == "r" && parseRangeLimit(tokens, limit, reverse) && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return limitRange(status, key, rightBound, limit, reverse);
+            } else if (tokens[0] == "ra" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return rangeAggregate(status, key, rightBound);
+            } else if (tokens[0] == "d" && tokens.size() == 2 && parseToken(tokens[1], key)) {
                 // std::cout << "Received delete command.\n" <<  std::endl;
-                return put(status, std::stoi(tokens[1]), 0, true);
+                return put(status, key, ValType(), true);
+            } else if (tokens[0] == "dr" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                // std::cout << "Received delete range command.\n" <<  std::endl;
+                return deleteRange(status, key, rightBound);
             } else {
                 return std::make_tuple(status,
                         "Supported commands: \n\n\
                         p x y — PUT\n\
+                        a x y — ADD y to the value of x (append for strings)\n\
                         g x   — GET\n\
                         r x y — RANGE\n\
+                        r x y n [asc|desc] — RANGE, first n pairs\n\
+                        ra x y — RANGE AGGREGATE (count, sum, min, max)\n\
+                        d x   — DELETE\n\
+                        dr x y — DELETE RANGE\n\
+                        k     — Print the knobs.\n\
+                        k n v — Set knob n to v.\n\
+                        stats — Print per-level statistics (stats json for JSON).\n\
+                        ks    — List the keyspaces.\n\
+                        ks n c — Run command c on keyspace n.\n\
                         p     — Print levels to server.\n\
                         pv    — Print levels to server (verbose).\n\
                         s     — Shutdown and persist.\n\
@@ -358,216 +1200,563 @@ class LSM {
             }
         }
 
-        size_t getPageSize() { return this->pageSize; }
-        size_t getBufferSize() { return this->bufferPages * this->getPageSize(); }
+        // `getStats()`
+        // Returns the session counters along with the current shape of every level.
+        Stats getStats() {
+            Stats stats = this->stats;
+            for (size_t l = 0; l < this->getNumLevels(); l++) {
+                LevelStats& level = stats.level(l);
+                level.runs = this->getLevel(l)->runs.size();
+                level.entries = this->getPairsInLevel(l);
+                level.bytes = 0;
+                for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) level.bytes += this->runBytes(run);
+            }
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                stats.valueLogBytes = this->valueLog.bytes();
+                stats.valueLogBytesWritten = this->valueLog.getBytesAppended();
+                stats.valueLogBytesRelocated = this->valueLog.getBytesRelocated();
+                stats.valueLogSegmentsCollected = this->valueLog.getSegmentsCollected();
+            }
+            stats.compactionRate = this->compactionLimiter.getRate();
+            stats.compactionPauseP99 = this->compactionLimiter.getPauseP99();
+            return stats;
+        }
+
+        size_t runBytes(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            return run->keys.bytes(run->numPairs) + run->vals.bytes(run->numPairs);
+        }
+
+        const Knobs& getKnobs() { return this->knobs; }
+        size_t getPageSize() { return this->knobs.pageSize; }
+        size_t getBufferSize() { return this->knobs.bufferPages * this->getPageSize(); }
+        size_t getRunCapacity() { return this->knobs.filePages * this->getPageSize(); }
         size_t getNumLevels() { return this->numLevels; }
-        size_t getSizeRatio() { return this->sizeRatio; }
-        Level<KeyType, ValType, DictValType>* getLevel(size_t l) { return this->levels[l]; }
-        KeyType* getLevelKeys(size_t l) { return this->getLevel(l)->keys; }
-        std::map<ValType, DictValType>& getLevelDict(size_t l) { return this->getLevel(l)->dict; }
-        bool* getLevelTombstone(size_t l) { return this->getLevel(l)->tombstone; }
-        size_t getPairsInLevel(size_t l) { return this->getLevel(l)->numPairs; }
-        size_t getLevelCapacity(size_t l) { return this->getBufferSize() * std::pow(this->getSizeRatio(), l); }
-        bool levelIsEmpty(size_t l) { return this->getPairsInLevel(l) == 0; }
-        KeyType getFenceKey(size_t l, size_t index) {
-            assert(this->getLevel(l)->fence != nullptr);
-            return this->getLevel(l)->fence[index];
+        size_t getSizeRatio() { return this->knobs.sizeRatio; }
+        Level<KeyType, ValType, DictValType, PolicyType>* getLevel(size_t l) { return this->levels[l]; }
+        Run<KeyType, ValType, DictValType, PolicyType>* getBuffer() { return this->getLevel(0)->runs[0]; }
+        Column<KeyType>& getRunKeys(Run<KeyType, ValType, DictValType, PolicyType>* run) { return run->keys; }
+        uint64_t* getRunTombstone(Run<KeyType, ValType, DictValType, PolicyType>* run) { return run->tombstone; }
+
+        // `getLevelCapacity()`
+        // The number of entries level l may hold before it is compacted into the next level. With
+        // DYNAMIC_LEVEL_SIZING the last level has no capacity, and the ones above it get the size of the
+        // last level divided by SIZE_RATIO once per level between them, but never less than the buffer.
+        size_t getLevelCapacity(size_t l) {
+            size_t fixed = this->getBufferSize() * std::pow(this->getSizeRatio(), l);
+            size_t last = this->getNumLevels() - 1;
+            if (!DYNAMIC_LEVEL_SIZING || l == 0) return fixed;
+            if (l >= last) return std::numeric_limits<size_t>::max();
+            size_t target = this->getPairsInLevel(last) / std::pow(this->getSizeRatio(), last - l);
+            return std::max(target, this->getBufferSize());
+        }
+        KeyType getFenceKey(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t index) {
+            if constexpr (PolicyType::index == INDEX_FENCE) {
+                assert(run->fence != nullptr);
+                return run->fence[index];
+            } else {
+                return this->getKey(run, index * this->getPageSize());
+            }
         }
-        size_t getFenceLength(size_t l) { return this->getLevel(l)->fenceLength; }
-        BloomFilter* getBloomFilter(size_t l) { return this->getLevel(l)->bloomFilter; }
 
+        size_t getPairsInLevel(size_t l) {
+            size_t numPairs = 0;
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) numPairs += run->numPairs;
+            return numPairs;
+        }
+
+        size_t getTombstonesInLevel(size_t l) {
+            size_t numTombstones = 0;
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) numTombstones += run->numTombstones;
+            return numTombstones;
+        }
+
+        bool levelIsEmpty(size_t l) { return this->getPairsInLevel(l) == 0; }
 
         int64_t getUniqueKeyCount(size_t l) {
             std::map<KeyType, bool> keys;
-            for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                keys[this->getKey(l, i)] = true;
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                for (size_t i = 0; i < run->numPairs; i++) {
+                    keys[this->getKey(run, i)] = true;
+                }
             }
             return keys.size();
         }
 
         int64_t getUniqueValCount(size_t l) {
             std::map<ValType, bool> vals;
-            for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                vals[this->getVal(l, i)] = true;
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) {
+                for (size_t i = 0; i < run->numPairs; i++) {
+                    vals[this->getVal(run, i)] = true;
+                }
             }
             return vals.size();
         }
 
         // `initializeLevel()`
         // This function is used when we intend to create a new empty level at the bottom of the LSM tree.
-        void initializeLevel(size_t l, KeyType* keysPointer, void* valsPointer, bool* tombstonePointer, size_t numPairs) {
+        void initializeLevel(size_t l) {
             assert(l == this->levels.size());
-            Level<KeyType, ValType, DictValType>* newLevel = new Level<KeyType, ValType, DictValType>;
-            newLevel->keys = keysPointer;
-            if (ENCODING_TYPE == ENCODING_OFF) newLevel->vals = static_cast<ValType*>(valsPointer);
-            else if (ENCODING_TYPE == ENCODING_DICT) newLevel->vals = static_cast<DictValType*>(valsPointer);
-            newLevel->tombstone = tombstonePointer;
-            newLevel->numPairs = numPairs;
-            this->levels.push_back(newLevel);
+            (void)l;
+            this->levels.push_back(new Level<KeyType, ValType, DictValType, PolicyType>);
             this->numLevels++;
-            this->constructFence(l);
-            this->constructBloomFilter(l);
+        }
+
+        // `growLevels()`
+        // With DYNAMIC_LEVEL_SIZING, inserts an empty level 1 beneath the buffer for as long as the last
+        // level holds more than a fixed level would. The other levels move down one, along with their
+        // stats and their entries in the level filter, so the levels above the last keep their targets.
+        void growLevels(void) {
+            if (!DYNAMIC_LEVEL_SIZING) return;
+            bool grown = false;
+            while (this->getNumLevels() > 1) {
+                size_t last = this->getNumLevels() - 1;
+                if (this->getPairsInLevel(last) <= this->getBufferSize() * std::pow(this->getSizeRatio(), last)) break;
+                this->levels.insert(this->levels.begin() + 1, new Level<KeyType, ValType, DictValType, PolicyType>);
+                this->numLevels++;
+                if (this->stats.levels.size() > 1) this->stats.levels.insert(this->stats.levels.begin() + 1, LevelStats());
+                grown = true;
+            }
+            if (grown) this->rebuildLevelFilter();
+        }
+
+        // `runFileName()`
+        // Returns the path of one of the files backing run `id`, e.g. `data/k12.data` for prefix `k`.
+        std::string runFileName(const std::string& prefix, size_t id) {
+            return this->dataDirectory + "/" + prefix + std::to_string(id) + ".data";
+        }
+
+        // `loadRun()`
+        // Maps the files of run `id` and rebuilds its in-memory state (fence, bloom filter,
+        // page tombstone counts, and dictionaries).
+        Run<KeyType, ValType, DictValType, PolicyType>* loadRun(size_t id, size_t capacity, size_t numPairs, double fpr) {
+            Run<KeyType, ValType, DictValType, PolicyType>* run = new Run<KeyType, ValType, DictValType, PolicyType>;
+            run->id = id;
+            run->capacity = capacity;
+            run->keys.open(this->runFileName("k", id), this->runFileName("kh", id), capacity, numPairs, KEY_RESTART_INTERVAL);
+            run->vals.open(this->runFileName("v", id), this->runFileName("vh", id), capacity, numPairs, 1);
+            run->tombstone = mmapBitmap(this->runFileName("t", id).c_str(), capacity);
+            run->operand = mmapBitmap(this->runFileName("o", id).c_str(), capacity);
+            run->numPairs = numPairs;
+            for (size_t i = 0; i < numPairs; i++) run->numOperands += (run->operand[i / 64] >> (i % 64)) & 1;
+
+            if constexpr (PolicyType::encoding == ENCODING_DICT) run->dict.open(this->runFileName("d", id));
+
+            this->constructFence(run);
+            this->constructBloomFilter(run, fpr);
+            this->constructRangeFilter(run);
+            this->constructPageTombstones(run);
+            this->constructPageSummaries(run);
+            return run;
+        }
+
+        // `createRun()`
+        // Returns a new empty run with a bloom filter sized for `fpr` and a range filter, reusing a recycled run of the same
+        // capacity if there is one. Called concurrently by subcompactions.
+        Run<KeyType, ValType, DictValType, PolicyType>* createRun(size_t capacity, double fpr) {
+            size_t id;
+            {
+                std::lock_guard<std::mutex> lock(this->runsMutex);
+                if (!this->recycledRuns.empty() && this->recycledRuns.back()->capacity == capacity) {
+                    Run<KeyType, ValType, DictValType, PolicyType>* run = this->recycledRuns.back();
+                    this->recycledRuns.pop_back();
+                    this->constructBloomFilter(run, fpr);
+                    this->constructRangeFilter(run);
+                    return run;
+                }
+                id = this->nextRunId++;
+            }
+            return this->loadRun(id, capacity, 0, fpr);
+        }
+
+        // `unmapRun()`
+        // Unmaps the files backing a run.
+        void unmapRun(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            run->keys.close();
+            run->vals.close();
+            munmap(this->getRunTombstone(run), bitmapWords(run->capacity) * sizeof(uint64_t));
+            munmap(run->operand, bitmapWords(run->capacity) * sizeof(uint64_t));
+            run->dict.close();
+        }
+
+        // `removeRunFiles()`
+        // Removes the files backing a run from the data folder.
+        void removeRunFiles(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            for (const char* prefix : {"k", "kh", "v", "vh", "t", "o", "d"}) {
+                std::filesystem::remove(this->runFileName(prefix, run->id));
+            }
+        }
+
+        // `deleteRun()`
+        // Retires a run that has been merged away. The run is cleared and kept for reuse by `createRun()`.
+        void deleteRun(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            this->clearRun(run);
+            this->recycledRuns.push_back(run);
         }
 
         // `appendPair()`
-        // Appends a new KV pair at the end of the specified level. If dictionary encoding is
+        // Appends a new KV pair at the end of the specified run. If dictionary encoding is
         // turned on, the key is stored as usual, and the value (of type `ValType`) and its dictionary encoded value
-        // (of type `DictValType`) are stored in the dictionary. In the case of DICT encoding, the dictionary 
+        // (of type `DictValType`) are stored in the dictionary. In the case of DICT encoding, the dictionary
         // encoded value is stored in the values array instead of the uncompressed value.
-        void appendPair(size_t l, KeyType key, ValType val, bool isDelete) {
-            this->getLevelKeys(l)[this->getPairsInLevel(l)] = key;
-            Level<KeyType, ValType, DictValType>* level = this->getLevel(l);
-            if (this->getLevel(l)->encodingType == ENCODING_DICT){
-
-                // std::cout << "Dict size: " << level->dict.size() << std::endl;
-                // std::cout << "DictValType capacity: " << static_cast<int>(std::numeric_limits<DictValType>::max() + 1) << std::endl;
-                
-                assert(level->dict.size() <= static_cast<int>(std::numeric_limits<DictValType>::max() + 1));
-                
-                // If this assertion is failing, it's because there are too many unique values
-                // to store in the number of bits given by DictValType (AKA this workload is not supported).
-                // Comment out the two lines above the assertion to see where the issue is arising. A future project is to
-                // make it so that the tree automatically increases the number of bits used in
-                // the dictionary, but for now it is fixed in `Types.hpp`.
-
-                if (level->dict.find(val) == level->dict.end()){
-                    level->dict[val] = level->dict.size();
-                    level->dictReverse.push_back(val);
-                }
-                DictValType* vals = static_cast<DictValType*>(this->getLevelVals(l));
-                vals[this->getPairsInLevel(l)] = level->dict[val];
+        //
+        // With VLOG encoding the value is appended to the value log and the run stores its pointer.
+        void appendPair(Run<KeyType, ValType, DictValType, PolicyType>* run, KeyType key, ValType val, bool isDelete, bool isOperand) {
+            if constexpr (PolicyType::encoding == ENCODING_DICT) {
+                this->appendStored(run, key, run->dict.encode(val), isDelete, isOperand);
+            } else if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                this->appendStored(run, key, isDelete ? ValueLog<KeyType, ValType>::NO_VALUE : this->valueLog.append(key, val), isDelete, isOperand);
             } else {
-                ValType* vals = static_cast<ValType*>(this->getLevelVals(l));
-                vals[this->getPairsInLevel(l)] = val;
+                this->appendStored(run, key, val, isDelete, isOperand);
             }
+        }
 
-            this->getLevelTombstone(l)[this->getPairsInLevel(l)] = isDelete;
-            this->getLevel(l)->numPairs++;
-            this->getLevel(l)->bloomFilter->add(key);
-            if (this->getPairsInLevel(l) == this->getLevelCapacity(l)) this->propagateLevel(l);
-            
-            return;
+        // `appendEntry()`
+        // Appends an entry moved from another run. With VLOG encoding only its pointer is copied.
+        void appendEntry(Run<KeyType, ValType, DictValType, PolicyType>* run, const MergeEntry& entry) {
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) this->appendStored(run, entry.key, entry.val, entry.isDelete, entry.isOperand);
+            else this->appendPair(run, entry.key, entry.val, entry.isDelete, entry.isOperand);
         }
 
-        // `getKey()`
-        // Returns the key at the index specified in the level specified.
-        KeyType getKey(size_t l, size_t entryIndex) {
-            return this->getLevelKeys(l)[entryIndex];
+        // `appendStored()`
+        // Appends a key and the value as stored in the values column: the value, its dictionary code, or
+        // its value log pointer.
+        void appendStored(Run<KeyType, ValType, DictValType, PolicyType>* run, const KeyType& key,
+                          const typename Run<KeyType, ValType, DictValType, PolicyType>::StoredValType& stored, bool isDelete, bool isOperand) {
+            assert(run->numPairs < run->capacity);
+            run->keys.append(run->numPairs, key);
+            run->vals.append(run->numPairs, stored);
+            this->setTomb(run, run->numPairs, isDelete);
+            this->setOperand(run, run->numPairs, isOperand);
+            if constexpr (PolicyType::encoding != ENCODING_VLOG) {
+                if (!isDelete && !isOperand) {
+                    size_t page = run->numPairs / this->getPageSize();
+                    if (page >= run->pageSummaries.size()) run->pageSummaries.resize(page + 1);
+                    if constexpr (PolicyType::encoding == ENCODING_DICT) run->pageSummaries[page].add(run->dict.decode(stored));
+                    else run->pageSummaries[page].add(stored);
+                }
+            }
+            run->numPairs++;
+            if constexpr (PolicyType::filter == FILTER_BLOOM) run->bloomFilter->add(key);
+            if constexpr (PolicyType::filter != FILTER_NONE && rangeFilterable<KeyType>) run->rangeFilter->add(rangeKey(key));
         }
 
-        // `getLevelVals()`
-        // Returns a void* either pointing to a vals array of type ValType* (in the case of no compression) or
-        // a vals array of type DictValType* (in the case that DICT compression is enabled).
-        void* getLevelVals(size_t l) {
-            if (this->getLevel(l)->encodingType == ENCODING_OFF) return std::get<ValType*>(this->getLevel(l)->vals);
-            else if (this->getLevel(l)->encodingType == ENCODING_DICT) return std::get<DictValType*>(this->getLevel(l)->vals);
-            assert(false); // If this assert executed, the encoding type is not supported.
-            return nullptr;
+        // `getKey()`
+        // Returns the key at the index specified in the run specified.
+        KeyType getKey(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            return run->keys.get(entryIndex);
         }
 
         // `getVal()`
-        // Returns the uncompressed value at the index specified in the level specified.
+        // Returns the uncompressed value at the index specified in the run specified.
         // Compatible with DICT encoding.
-        ValType getVal(size_t l, size_t entryIndex) {
-            if (this->getLevel(l)->encodingType == ENCODING_OFF) {
-                return std::get<ValType*>(this->getLevel(l)->vals)[entryIndex];
-            } else if (this->getLevel(l)->encodingType == ENCODING_DICT) {
-                DictValType dictIndex = std::get<DictValType*>(this->getLevel(l)->vals)[entryIndex];
-                return this->getLevel(l)->dictReverse[dictIndex];
-            }
-            assert(false); // If this assert executed, the encoding type is not supported.
-            return 0;
+        ValType getVal(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            if constexpr (PolicyType::encoding == ENCODING_DICT) {
+                return run->dict.decode(run->vals.get(entryIndex));
+            } else if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                return this->valueLog.read(run->vals.get(entryIndex));
+            } else {
+                return run->vals.get(entryIndex);
+            }
+        }
+
+        // `getEntryVal()`
+        // Returns the value of an entry as an `Entry` carries it, see `EntryValType`.
+        EntryValType getEntryVal(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) return run->vals.get(entryIndex);
+            else return this->getVal(run, entryIndex);
+        }
+
+        // `readEntryVal()`
+        // Returns the value an `Entry` carries, reading it from the value log with VLOG encoding.
+        ValType readEntryVal(const EntryValType& val) {
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) return this->valueLog.read(val);
+            else return val;
+        }
+
+        // `readEntry()`
+        // Returns entry i of a run as it moves to another run.
+        MergeEntry readEntry(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            bool tomb = this->pageHasTombstones(run, entryIndex / this->getPageSize()) && this->getTomb(run, entryIndex);
+            return {this->getKey(run, entryIndex), this->getEntryVal(run, entryIndex), tomb, this->getOperand(run, entryIndex)};
+        }
+
+        // `applyOperand()`
+        // Applies an operand to the older entry of its key, see `foldOperand()`. A put or an operand
+        // takes the folded value and stays what it was, while a tombstone gives way to a put of the
+        // operand, as if onto a missing value. With VLOG encoding the folded value is appended to the
+        // value log and the two it came from become garbage.
+        MergeEntry applyOperand(const MergeEntry& older, const MergeEntry& operand) {
+            if (older.isDelete) return {operand.key, operand.val, false, false};
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                uint64_t pointer = this->valueLog.append(operand.key, foldOperand(this->valueLog.read(older.val), this->valueLog.read(operand.val)));
+                this->valueLog.discard(older.val);
+                this->valueLog.discard(operand.val);
+                return {operand.key, pointer, false, older.isOperand};
+            } else {
+                return {operand.key, foldOperand(older.val, operand.val), false, older.isOperand};
+            }
+        }
+
+        // `discardEntry()`
+        // Called when a flush or merge drops entry i of a run. With VLOG encoding its value becomes
+        // garbage in the value log. Safe to call from concurrent subcompactions.
+        void discardEntry(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) this->valueLog.discard(run->vals.get(entryIndex));
+            else (void)run, (void)entryIndex;
         }
 
         // `getTomb()`
-        // Returns the tombstone bit at the index specified in the level specified. `1` means to delete.
-        bool getTomb(size_t l, size_t entryIndex) {
-            return this->getLevelTombstone(l)[entryIndex];
+        // Returns the tombstone bit at the index specified in the run specified. `1` means to delete.
+        bool getTomb(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            return (this->getRunTombstone(run)[entryIndex / 64] >> (entryIndex % 64)) & 1;
+        }
+
+        // `setTomb()`
+        // Sets or clears the tombstone bit at the index specified and keeps the per-page tombstone
+        // counts up to date. Bits are always written since `clearRun()` does not reset the bitmap.
+        void setTomb(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex, bool isDelete) {
+            uint64_t mask = static_cast<uint64_t>(1) << (entryIndex % 64);
+            if (isDelete) {
+                this->getRunTombstone(run)[entryIndex / 64] |= mask;
+                run->numTombstones++;
+                run->tombstonesSince = std::min(run->tombstonesSince, this->flushes);
+                size_t page = entryIndex / this->getPageSize();
+                if (page >= run->pageTombstones.size()) run->pageTombstones.resize(page + 1, 0);
+                run->pageTombstones[page]++;
+            } else {
+                this->getRunTombstone(run)[entryIndex / 64] &= ~mask;
+            }
+        }
+
+        // `getOperand()`
+        // Returns whether the entry at the index specified is an operand. Runs without operands skip
+        // the bitmap.
+        bool getOperand(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex) {
+            return run->numOperands > 0 && ((run->operand[entryIndex / 64] >> (entryIndex % 64)) & 1);
         }
-        
+
+        // `setOperand()`
+        // Sets or clears the operand bit at the index specified, like `setTomb()`.
+        void setOperand(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t entryIndex, bool isOperand) {
+            uint64_t mask = static_cast<uint64_t>(1) << (entryIndex % 64);
+            if (isOperand) {
+                run->operand[entryIndex / 64] |= mask;
+                run->numOperands++;
+            } else {
+                run->operand[entryIndex / 64] &= ~mask;
+            }
+        }
+
+        // `pageHasTombstones()`
+        // Returns whether any entry on the specified page of the run is a tombstone.
+        bool pageHasTombstones(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t page) {
+            return page < run->pageTombstones.size() && run->pageTombstones[page] > 0;
+        }
+
+        // `constructPageTombstones()`
+        // Rebuilds the per-page tombstone counts of a run from the tombstone bitmap. Called when
+        // a run is loaded from disk.
+        void constructPageTombstones(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            run->pageTombstones.assign((run->numPairs + this->getPageSize() - 1) / this->getPageSize(), 0);
+            run->numTombstones = 0;
+            for (size_t i = 0; i < run->numPairs; i++) {
+                if (this->getTomb(run, i)) {
+                    run->pageTombstones[i / this->getPageSize()]++;
+                    run->numTombstones++;
+                }
+            }
+            // Tombstone ages are not persisted, so loaded tombstones start aging from now.
+            if (run->numTombstones > 0) run->tombstonesSince = this->flushes;
+        }
+
+        // `constructPageSummaries()`
+        // Rebuilds the per-page summaries of a run from its values. Called when a run is loaded or the
+        // page size changes.
+        void constructPageSummaries(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            run->pageSummaries.clear();
+            if constexpr (PolicyType::encoding != ENCODING_VLOG) {
+                run->pageSummaries.resize((run->numPairs + this->getPageSize() - 1) / this->getPageSize());
+                for (size_t i = 0; i < run->numPairs; i++) {
+                    if (!this->getTomb(run, i) && !this->getOperand(run, i)) run->pageSummaries[i / this->getPageSize()].add(this->getVal(run, i));
+                }
+            }
+        }
+
+        // `pageLowerBound()`
+        // Returns the index of the first entry not less than `key` on the specified page of a sorted run,
+        // or the end of the page.
+        size_t pageLowerBound(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t page, const KeyType& key) {
+            size_t l = page * this->getPageSize(), r = std::min(l + this->getPageSize(), run->numPairs);
+            while (l < r) {
+                size_t m = (l + r) / 2;
+                if (this->getKey(run, m) < key) l = m + 1;
+                else r = m;
+            }
+            return l;
+        }
+
+        // `pageContains()`
+        // Returns whether the specified page of a sorted run holds an entry for `key`.
+        bool pageContains(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t page, const KeyType& key) {
+            size_t i = this->pageLowerBound(run, page, key);
+            return i < std::min((page + 1) * this->getPageSize(), run->numPairs) && this->getKey(run, i) == key;
+        }
+
         // `constructFence()`
-        // Constructs the fence pointer array at level l within the catalog.
-        void constructFence(size_t l) {
-            if (l == 0) return;
-            delete[] this->getLevel(l)->fence;
-            this->getLevel(l)->fenceLength = std::ceil(static_cast<double>(this->getLevel(l)->numPairs) / this->getPageSize());
-            this->getLevel(l)->fence = new KeyType[this->getLevel(l)->fenceLength];
-            for (size_t i = 0, j = 0; i < this->getLevel(l)->fenceLength; i++, j += this->getPageSize()) {
-                if (j >= this->getLevel(l)->numPairs) {
+        // Constructs the fence pointer array of a run. The buffer's fence is never used since the
+        // buffer is unsorted.
+        void constructFence(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            run->fenceLength = std::ceil(static_cast<double>(run->numPairs) / this->getPageSize());
+            if constexpr (PolicyType::index == INDEX_BINARY_SEARCH) return;
+            delete[] run->fence;
+            run->fence = new KeyType[run->fenceLength];
+            for (size_t i = 0, j = 0; i < run->fenceLength; i++, j += this->getPageSize()) {
+                if (j >= run->numPairs) {
                     std::cout << "constructFence(): Out of bounds access error." << std::endl;
                     return;
                 }
-                this->getLevel(l)->fence[i] = this->getKey(l, j);
+                run->fence[i] = this->getKey(run, j);
             }
         }
 
+        // `bloomFpr()`
+        // Returns the false positive rate that the bloom filters of level l are built for.
+        double bloomFpr(size_t l) {
+            if (l == 0 || this->knobs.bloomAllocation == BLOOM_UNIFORM) return this->knobs.bloomTargetFpr;
+            return monkeyFpr(this->knobs.bloomTargetFpr, this->getSizeRatio(), std::max<size_t>(1, this->getNumLevels() - 1), l);
+        }
+
         // `constructBloomFilter()`
-        // Constructs a bloom filter boolean vector over the keys for the specified level based on the current state of the level. 
-        // Called at the end of `propagateLevel()` and in `populateCatalog()`.
-        void constructBloomFilter(size_t l) {
-            size_t levelSize = this->getLevelCapacity(l);
-            size_t numBits = static_cast<size_t>(-(levelSize * std::log(BLOOM_TARGET_FPR)) / std::pow(std::log(2), 2));
-            
+        // Constructs a bloom filter boolean vector over the keys of a run based on its current state,
+        // sized for the false positive rate `fpr`. Called whenever a run is loaded or created.
+        void constructBloomFilter(Run<KeyType, ValType, DictValType, PolicyType>* run, double fpr) {
+            if constexpr (PolicyType::filter != FILTER_BLOOM) return;
+            size_t runSize = run->capacity;
+            size_t numBits = std::max<size_t>(1, static_cast<size_t>(-(runSize * std::log(fpr)) / std::pow(std::log(2), 2)));
+
             // Calculate the optimal number of hash functions.
-            size_t numHashes = static_cast<size_t>((numBits / static_cast<double>(levelSize)) * std::log(2));
+            size_t numHashes = static_cast<size_t>((numBits / static_cast<double>(runSize)) * std::log(2));
             if (numHashes < 1) numHashes = 1;
 
-            if (this->getLevel(l)->bloomFilter != nullptr) {
-                this->getLevel(l)->bloomFilter->clear();
+            if (run->bloomFilter != nullptr && run->bloomFilter->numBits() == numBits && run->bloomFilter->numHashFunctions() == numHashes) {
+                run->bloomFilter->clear();
             } else {
-                this->getLevel(l)->bloomFilter = new BloomFilter(numBits, numHashes);
+                delete run->bloomFilter;
+                run->bloomFilter = new BloomFilter(numBits, numHashes);
             }
 
-            if (!this->levelIsEmpty(l)) {
-                for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                    this->getLevel(l)->bloomFilter->add(this->getKey(l, i));
-                }
+            for (size_t i = 0; i < run->numPairs; i++) {
+                run->bloomFilter->add(this->getKey(run, i));
             }
         }
 
-        // `sortLevel()`
-        // Sorts the level indicated. Also handles fence pointers and the bloom filter.
-        void sortLevel(size_t l) {
-            if (l >= this->getNumLevels()) {
-                std::cout << "sortLevel(): Tried to sort nonexistent level." << std::endl;
-                return;
+        // `constructRangeFilter()`
+        // Constructs the range filter over the keys of a run, sized for its capacity. Called whenever a
+        // run is loaded or created.
+        void constructRangeFilter(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            if constexpr (PolicyType::filter == FILTER_NONE || !rangeFilterable<KeyType>) return;
+            else {
+                size_t numBits = std::max<size_t>(64, (run->capacity * RANGE_FILTER_LEVELS * RANGE_FILTER_BITS_PER_PREFIX + 63) / 64 * 64);
+                size_t numHashes = std::max<size_t>(1, static_cast<size_t>(RANGE_FILTER_BITS_PER_PREFIX * std::log(2)));
+                if (run->rangeFilter != nullptr && run->rangeFilter->numBits() == numBits) {
+                    run->rangeFilter->clear();
+                } else {
+                    delete run->rangeFilter;
+                    run->rangeFilter = new RangeFilter(numBits, numHashes);
+                }
+                for (size_t i = 0; i < run->numPairs; i++) {
+                    run->rangeFilter->add(rangeKey(this->getKey(run, i)));
+                }
             }
+        }
 
-            // This map effectively only keeps the most recent value for a given key. So if a key has been written more than once,
-            // only the most recent value will be kept. The map is also ordered which lets us write directly back to the level.
-            // We also filter out all of the deletions during this process.
-            std::map<KeyType, std::pair<ValType, bool>> pairs;
-            for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                pairs[this->getKey(l, i)] = std::make_pair(this->getVal(l, i), this->getTomb(l, i));
+        // `indexRun()`
+        // Adds the keys of a run, now part of level l, to the level filter. Only used with FILTER_CUCKOO.
+        void indexRun(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t l) {
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                for (size_t i = 0; i < run->numPairs; i++) this->levelFilter.add(bloomHash(this->getKey(run, i)).h1, l);
             }
+        }
 
-            this->clearLevel(l);
+        // `unindexRun()`
+        // Removes the keys of a run leaving level l from the level filter.
+        void unindexRun(Run<KeyType, ValType, DictValType, PolicyType>* run, size_t l) {
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                for (size_t i = 0; i < run->numPairs; i++) this->levelFilter.remove(bloomHash(this->getKey(run, i)).h1, l);
+            }
+        }
 
-            for (const std::pair<KeyType, std::pair<ValType, bool>>& pair : pairs) {
-                // Append the pairs in order, except in the case that it is a tombstone on the final level.
-                if (!(l == this->getNumLevels() - 1 && pair.second.second == true)) {
-                    this->appendPair(l, pair.first, pair.second.first, pair.second.second);
+        // `rebuildLevelFilter()`
+        // Rebuilds the level filter from the runs of every level, with LEVEL_FILTER_HEADROOM times as
+        // much room as they need and at least half as much again as before if an insert overflowed.
+        // Called on startup and after any command whose inserts overflowed the filter.
+        void rebuildLevelFilter(void) {
+            if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                size_t numEntries = 0;
+                for (size_t l = 0; l < this->getNumLevels(); l++) numEntries += this->getPairsInLevel(l);
+                size_t capacity = static_cast<size_t>(numEntries * LEVEL_FILTER_HEADROOM) + this->getBufferSize();
+                if (this->levelFilter.overflowed()) capacity = std::max(capacity, this->levelFilter.capacity() * 3 / 2);
+                this->levelFilter.reset(capacity);
+                for (size_t l = 0; l < this->getNumLevels(); l++) {
+                    for (Run<KeyType, ValType, DictValType, PolicyType>* run : this->getLevel(l)->runs) this->indexRun(run, l);
                 }
             }
+        }
+
+        // `sortBuffer()`
+        // Returns the contents of the buffer sorted by key, keeping only the most recent entry for
+        // each key. Tombstones are kept since they may still shadow entries in deeper levels. Operands
+        // are applied to the entry before them, see `applyOperand()`.
+        //
+        // The buffer's (key, arrival index) pairs are sorted stably, so the last pair for a key is its
+        // most recent write and a linear pass dedups them. Integral keys are radix sorted; other key
+        // types fall back to a comparison sort. The scratch vectors are reused across flushes, so a
+        // flush does not allocate once they have grown to the buffer size.
+        const std::vector<MergeEntry>& sortBuffer(void) {
+            Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+            this->sortPairs.resize(buffer->numPairs);
+            for (size_t i = 0; i < buffer->numPairs; i++) {
+                this->sortPairs[i] = std::make_pair(this->getKey(buffer, i), static_cast<uint32_t>(i));
+            }
+
+            if constexpr (std::is_integral_v<KeyType>) {
+                this->sortScratch.resize(buffer->numPairs);
+                radixSort(this->sortPairs, this->sortScratch);
+            } else {
+                std::stable_sort(this->sortPairs.begin(), this->sortPairs.end(), [](const auto& a, const auto& b) {
+                    return a.first < b.first;
+                });
+            }
 
-            this->constructFence(l);
-            this->constructBloomFilter(l);
+            this->flushEntries.clear();
+            for (size_t k = 0, end = 0; k < this->sortPairs.size(); k = end) {
+                // The writes of the key are [k, end), oldest first. The newest of them that is not an
+                // operand takes the operands after it, and the writes before it are dropped.
+                for (end = k + 1; end < this->sortPairs.size() && this->sortPairs[end].first == this->sortPairs[k].first; end++);
+                size_t base = end - 1;
+                while (base > k && this->getOperand(buffer, this->sortPairs[base].second)) base--;
+                for (size_t m = k; m < base; m++) this->discardEntry(buffer, this->sortPairs[m].second);
+                MergeEntry entry = this->readEntry(buffer, this->sortPairs[base].second);
+                for (size_t m = base + 1; m < end; m++) entry = this->applyOperand(entry, this->readEntry(buffer, this->sortPairs[m].second));
+                this->flushEntries.push_back(entry);
+            }
+            return this->flushEntries;
         }
 
         // `searchFence()`
-        // Searches through the fence pointers at level l for the specified key.
+        // Searches through the fence pointers of a run for the specified key.
         // Returns the page on which the key will be found if it exists.
-        int searchFence(size_t level, KeyType key) {
+        int searchFence(Run<KeyType, ValType, DictValType, PolicyType>* run, KeyType key) {
             // Binary search through the fence pointers to get the target page.
-            int l = 0, r = this->getFenceLength(level) - 1;
+            int l = 0, r = run->fenceLength - 1;
             while (l <= r) {
                 // The target page is the final page.
-                if (l == (int)this->getFenceLength(level)- 1) break;
+                if (l == (int)run->fenceLength - 1) break;
 
                 int m = (l + r) / 2;
-                if (this->getFenceKey(level, m) <= key && key < this->getFenceKey(level, m + 1)) {
+                if (this->getFenceKey(run, m) <= key && key < this->getFenceKey(run, m + 1)) {
                     return m;
-                } else if (this->getFenceKey(level, m) < key) {
+                } else if (this->getFenceKey(run, m) < key) {
                     l = m + 1;
                 } else {
                     r = m - 1;
@@ -576,60 +1765,94 @@ class LSM {
             return r;
         }
 
-        bool searchBloomFilter(size_t level, KeyType key) {
-            return this->getBloomFilter(level)->mayContain(key);
+        bool searchBloomFilter(Run<KeyType, ValType, DictValType, PolicyType>* run, KeyType key) {
+            if constexpr (PolicyType::filter != FILTER_BLOOM) return true;
+            else return run->bloomFilter->mayContain(key);
+        }
+
+        // `searchRangeFilter()`
+        // Returns false only if the run holds no key in [leftBound, rightBound). String keys are only
+        // filtered on their first 8 bytes, so the image of the right bound is kept.
+        bool searchRangeFilter(Run<KeyType, ValType, DictValType, PolicyType>* run, const KeyType& leftBound, const KeyType& rightBound) {
+            if (run->rangeFilter == nullptr) return true;
+            if (!(leftBound < rightBound)) return false;
+            uint64_t hi = rangeKey(rightBound);
+            if constexpr (std::is_integral_v<KeyType>) hi--;
+            return run->rangeFilter->mayContain(rangeKey(leftBound), hi);
+        }
+
+        // `findRunIndex()`
+        // Returns the index of the run in level l whose key span contains `key`, that is, the last run
+        // starting at or before `key`. Returns 0 if `key` comes before every run.
+        size_t findRunIndex(size_t l, KeyType key) {
+            const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+            auto it = std::upper_bound(runs.begin(), runs.end(), key, [this](KeyType k, Run<KeyType, ValType, DictValType, PolicyType>* run) {
+                return k < this->getKey(run, 0);
+            });
+            return it == runs.begin() ? 0 : (it - runs.begin()) - 1;
         }
 
-        // `searchLevel()`
-        // Searches for a key within level l of the LSM tree. Returns the index i
-        // of the key if it exists within the level, or -1 otherwise.
+        // `findRun()`
+        // Returns the run of level l that may hold `key`, or nullptr if no run's key range covers it.
+        Run<KeyType, ValType, DictValType, PolicyType>* findRun(size_t l, KeyType key) {
+            if (l == 0) return this->getBuffer();
+            const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+            if (runs.empty()) return nullptr;
+            Run<KeyType, ValType, DictValType, PolicyType>* run = runs[this->findRunIndex(l, key)];
+            if (key < this->getKey(run, 0) || this->getKey(run, run->numPairs - 1) < key) return nullptr;
+            return run;
+        }
+
+        // `searchRun()`
+        // Searches for a key within a run. Returns the index i of the key if it exists within the run,
+        // or -1 otherwise.
         //
-        // `searchLevel()` contains a switch that allows it to be used for range queries.
-        // For a range query, in the case that the target key does not exist, we return the 
+        // `searchRun()` contains a switch that allows it to be used for range queries.
+        // For a range query, in the case that the target key does not exist, we return the
         // smallest value larger than `key`. For a leftBound, this means we will get only
         // values larger than the leftBound, which is correct. This is correct for rightBounds
         // because the rightBound in these range queries is an exclusive bound.
-        int searchLevel(size_t level, KeyType key, bool range) {
+        int searchRun(Run<KeyType, ValType, DictValType, PolicyType>* run, KeyType key, bool range) {
 
             if (!range) this->stats.searchLevelCalls++;
             if (!range) {
-                if (this->levelIsEmpty(level) || !searchBloomFilter(level, key)) return -1;
+                if (run->numPairs == 0 || !searchBloomFilter(run, key)) return -1;
             } else {
-                // Level is empty or bound is outside the range of keys in the level. Return 0 or len(level) - 1.
-                if (this->levelIsEmpty(level) || key < this->getKey(level, 0)) return 0;
-                if (key > this->getKey(level, this->getPairsInLevel(level) - 1)) return this->getPairsInLevel(level);
+                // Run is empty or bound is outside the range of keys in the run. Return 0 or len(run) - 1.
+                if (run->numPairs == 0 || key < this->getKey(run, 0)) return 0;
+                if (key > this->getKey(run, run->numPairs - 1)) return run->numPairs;
             }
 
-            // The buffer, l0, is not sorted by key. All layers beneath l0 are sorted by key.
+            // The buffer, l0, is not sorted by key. All runs beneath l0 are sorted by key.
 
-            if (level == 0) {
+            if (run == this->getBuffer()) {
                 // Iterate backwards through the buffer to get the most recent entry.
-                for (int i = this->getPairsInLevel(level) - 1; i >= 0; i--) {
-                    if (this->getKey(level, i) == key) {
+                for (int i = run->numPairs - 1; i >= 0; i--) {
+                    if (this->getKey(run, i) == key) {
                         if (!range) this->stats.bloomTruePositives++;
                         return i;
                     }
                 }
             } else {
-                KeyType pageIndex = searchFence(level, key);
+                int pageIndex = searchFence(run, key);
                 if (pageIndex != -1) {
                     // Binary search within the page.
-                    KeyType l = pageIndex * this->getPageSize();
-                    KeyType r = (pageIndex + 1) * this->getPageSize();
-                    if ((KeyType)this->getPairsInLevel(level) - 1 < r) r = (KeyType)this->getPairsInLevel(level) - 1;
+                    int l = pageIndex * this->getPageSize();
+                    int r = (pageIndex + 1) * this->getPageSize();
+                    if ((int)run->numPairs - 1 < r) r = (int)run->numPairs - 1;
                     while (l <= r) {
-                        KeyType m = (l + r) / 2;
-                        if (this->getKey(level, m) == key) {
+                        int m = (l + r) / 2;
+                        if (this->getKey(run, m) == key) {
                             if (!range) this->stats.bloomTruePositives++;
                             return m;
-                        } else if (this->getKey(level, m) < key) {
+                        } else if (this->getKey(run, m) < key) {
                             l = m + 1;
                         } else {
                             r = m - 1;
                         }
                     }
                     if (range) {
-                        if (l > (KeyType)this->getPairsInLevel(level)) l = this->getPairsInLevel(level);
+                        if (l > (int)run->numPairs) l = run->numPairs;
                         return l;
                     }
                 }
@@ -640,44 +1863,488 @@ class LSM {
             return -1;
         }
 
-        // `clearLevel()`
-        // Clears the specified level by resetting the number of pairs to 0, deleting the fence, and
-        // clearing the bloom filter. Does not reset all values in the level array.
-        void clearLevel(size_t l) {
-            this->getLevel(l)->numPairs = 0;
-            delete[] this->getLevel(l)->fence;
-            this->getLevel(l)->fence = nullptr;
-            this->getLevel(l)->fenceLength = 0;
-            this->getLevel(l)->bloomFilter->clear();
+        // `clearRun()`
+        // Clears the specified run by resetting the number of pairs to 0, deleting the fence, and
+        // clearing the bloom filter. Does not reset all values in the run arrays.
+        void clearRun(Run<KeyType, ValType, DictValType, PolicyType>* run) {
+            run->numPairs = 0;
+            run->keys.clear();
+            run->vals.clear();
+            delete[] run->fence;
+            run->fence = nullptr;
+            run->fenceLength = 0;
+            if constexpr (PolicyType::filter == FILTER_BLOOM) run->bloomFilter->clear();
+            if (run->rangeFilter != nullptr) run->rangeFilter->clear();
+            run->pageTombstones.clear();
+            run->pageSummaries.clear();
+            run->numTombstones = 0;
+            run->numOperands = 0;
+            run->tombstonesSince = std::numeric_limits<size_t>::max();
 
             // Clear the dictionary.
-            this->getLevel(l)->dict.clear();
-            this->getLevel(l)->dictReverse.clear();
+            if constexpr (PolicyType::encoding == ENCODING_DICT) run->dict.clear();
+        }
+
+        // `applyRangeTombstones()`
+        // Drops every entry of a run covered by the given range tombstones. The surviving entries
+        // are rewritten in their original order so that the buffer keeps its recency ordering.
+        void applyRangeTombstones(Run<KeyType, ValType, DictValType, PolicyType>* run, const RangeTombstones<KeyType>& deleted) {
+            if (deleted.empty() || run->numPairs == 0) return;
+
+            std::vector<MergeEntry> survivors;
+            bool dropped = false;
+            for (size_t i = 0; i < run->numPairs; i++) {
+                if (deleted.covers(this->getKey(run, i))) {
+                    this->discardEntry(run, i);
+                    dropped = true;
+                } else {
+                    survivors.push_back(this->readEntry(run, i));
+                }
+            }
+            if (!dropped) return;
+
+            size_t tombstonesSince = run->tombstonesSince;
+            this->clearRun(run);
+            for (const MergeEntry& entry : survivors) {
+                this->appendEntry(run, entry);
+            }
+            if (run->numTombstones > 0) run->tombstonesSince = tombstonesSince;
+        }
+
+        // `tombstoneRatio()`
+        // Returns the fraction of entries in level l that are point tombstones.
+        double tombstoneRatio(size_t l) {
+            if (this->levelIsEmpty(l)) return 0;
+            return static_cast<double>(this->getTombstonesInLevel(l)) / this->getPairsInLevel(l);
+        }
+
+        // `isStale()`
+        // Returns whether tombstones that arrived at the given flush count are older than TOMBSTONE_MAX_AGE.
+        bool isStale(size_t since) {
+            return since != std::numeric_limits<size_t>::max() && this->flushes - since > TOMBSTONE_MAX_AGE;
+        }
+
+        // `compactTombstones()`
+        // Called after each buffer flush. Compacts a run into the next level early if its level is dense
+        // with tombstones or it has held tombstones for too long, so deletes reach the last level (where
+        // they are dropped along with the entries they shadow) instead of waiting for the level to fill up.
+        // Levels smaller than a page are left alone to avoid merging for a handful of deletes. These merges
+        // wait for the compaction limiter to admit their lane like any other.
+        void compactTombstones(void) {
+            for (size_t l = 1; l + 1 < this->getNumLevels(); l++) {
+                Level<KeyType, ValType, DictValType, PolicyType>* level = this->getLevel(l);
+                bool dense = this->getPairsInLevel(l) >= this->getPageSize() && this->tombstoneRatio(l) > TOMBSTONE_COMPACTION_RATIO;
+
+                // Pick the first run holding stale tombstones, or else the run with the most tombstones.
+                std::optional<size_t> target;
+                for (size_t r = 0; r < level->runs.size(); r++) {
+                    Run<KeyType, ValType, DictValType, PolicyType>* run = level->runs[r];
+                    if (run->numTombstones == 0) continue;
+                    if (this->isStale(run->tombstonesSince)) {
+                        target = r;
+                        break;
+                    }
+                    if (dense && (!target || level->runs[*target]->numTombstones < run->numTombstones)) target = r;
+                }
+                // Stale range tombstones are pushed down along with the run owning the first of them.
+                if (!target && this->isStale(level->rangeTombstonesSince)) {
+                    target = level->runs.empty() ? 0 : this->findRunIndex(l, level->rangeTombstones.begin()->first);
+                }
+
+                if (target && this->compactionLimiter.admit(l == 1 ? COMPACTION_L1 : COMPACTION_DEEP)) {
+                    this->stats.tombstoneCompactions++;
+                    this->compactRun(l, *target);
+                    this->compactPending();
+                }
+            }
+        }
+
+        // `findOlder()`
+        // Returns the level, run, and index of the newest entry for `key` older than entry i of level l,
+        // tombstones included, or a null run if the key has no such visible entry. Only the buffer holds
+        // older entries in the same level, before i, so l = 0 and i = the buffer size finds the newest
+        // entry of all. Unlike `get()`, it does not count towards the stats.
+        std::tuple<size_t, Run<KeyType, ValType, DictValType, PolicyType>*, size_t> findOlder(const KeyType& key, size_t l, size_t i) {
+            if (l == 0 && this->searchBloomFilter(this->getBuffer(), key)) {
+                while (i-- > 0) {
+                    if (this->getKey(this->getBuffer(), i) == key) return {0, this->getBuffer(), i};
+                }
+            }
+            while (!this->getLevel(l)->rangeTombstones.covers(key) && ++l < this->getNumLevels()) {
+                Run<KeyType, ValType, DictValType, PolicyType>* run = this->findRun(l, key);
+                if (run == nullptr || run->numPairs == 0 || !this->searchBloomFilter(run, key)) continue;
+                // `findRun()` checked that the key is within the run, so the search lands on its page.
+                size_t j = this->searchRun(run, key, true);
+                if (j < run->numPairs && this->getKey(run, j) == key) return {l, run, j};
+            }
+            return {0, nullptr, 0};
+        }
+
+        // `collectValueLog()`
+        // Garbage collects the value log after a buffer flush, one segment at a time so that a flush never
+        // waits for more than one segment: picks the sealed segment with the most dead records, copies
+        // each record that the newest entry of its key still points to onto the head of the log, points
+        // that entry at the copy in place, and deletes the segment. Operands still need the older entries
+        // of their key, so the entries beneath the newest are also live as far as the first non-operand.
+        void collectValueLog(void) {
+            std::optional<uint64_t> segment = this->valueLog.pickGarbage(VLOG_GC_RATIO);
+            if (!segment) return;
+            this->valueLog.forEachRecord(*segment, [this](const KeyType& key, uint64_t pointer) {
+                auto [l, run, i] = this->findOlder(key, 0, this->getBuffer()->numPairs);
+                while (run != nullptr && !this->getTomb(run, i) && run->vals.get(i) != pointer && this->getOperand(run, i)) {
+                    std::tie(l, run, i) = this->findOlder(key, l, i);
+                }
+                if (run == nullptr || this->getTomb(run, i) || run->vals.get(i) != pointer) return;
+                run->vals.set(i, this->valueLog.relocate(pointer));
+            });
+            this->valueLog.drop(*segment);
+        }
+
+        // `flushBuffer()`
+        // Sorts the full buffer and merges it into level 1 along with its range tombstones, then
+        // compacts the levels that have grown past their capacity as far as `compactPending()` allows.
+        void flushBuffer(void) {
+            this->flushes++;
+            Run<KeyType, ValType, DictValType, PolicyType>* buffer = this->getBuffer();
+            const std::vector<MergeEntry>& entries = this->sortBuffer();
+            size_t tombstonesSince = buffer->tombstonesSince;
+            RangeTombstones<KeyType> moved = this->getLevel(0)->rangeTombstones.extract(std::nullopt, std::nullopt);
+            size_t rangeTombstonesSince = this->getLevel(0)->rangeTombstonesSince;
+            this->getLevel(0)->rangeTombstonesSince = std::numeric_limits<size_t>::max();
+            this->stats.level(0).bytesRead += this->runBytes(buffer);
+            this->unindexRun(buffer, 0);
+            this->clearRun(buffer);
+
+            this->mergeInto(1, entries, tombstonesSince, moved, rangeTombstonesSince);
+            this->compactPending();
+        }
+
+        // `compactPending()`
+        // Compacts a run of the shallowest level at or above its capacity whose lane the compaction
+        // limiter admits, until none is left. Levels the limiter holds back stay over capacity until a
+        // later flush, unless they reach COMPACTION_STALL_RATIO times their capacity, which stalls the
+        // write until they are compacted. Each round first grows the tree if the last level needs it.
+        void compactPending(void) {
+            while (true) {
+                this->growLevels();
+                std::optional<size_t> next;
+                bool pending = false;
+                for (size_t l = 1; l < this->getNumLevels() && !next; l++) {
+                    size_t pairs = this->getPairsInLevel(l), capacity = this->getLevelCapacity(l);
+                    if (pairs < capacity) continue;
+                    pending = true;
+                    if (pairs >= capacity * COMPACTION_STALL_RATIO) {
+                        this->stats.compactionStalls++;
+                        next = l;
+                    } else if (this->compactionLimiter.admit(l == 1 ? COMPACTION_L1 : COMPACTION_DEEP)) {
+                        next = l;
+                    }
+                }
+                if (!next) {
+                    if (pending) this->stats.compactionsDeferred++;
+                    return;
+                }
+                this->compactRun(*next, this->pickRun(*next));
+            }
+        }
+
+        // `compactLevel()`
+        // While level l is at or above its capacity, compacts one of its runs into level l + 1, whatever
+        // the compaction limiter says.
+        void compactLevel(size_t l) {
+            while (l < this->getNumLevels() && this->getPairsInLevel(l) >= this->getLevelCapacity(l)) {
+                this->compactRun(l, this->pickRun(l));
+                this->compactLevel(l + 1);
+            }
+        }
+
+        // `pickRun()`
+        // Picks the next run of level l to compact. With MERGE_ROUND_ROBIN this is the first run after
+        // the compaction cursor, wrapping around to the start of the level. With MERGE_MIN_OVERLAP it is
+        // the run overlapping the fewest pairs in level l + 1.
+        size_t pickRun(size_t l) {
+            Level<KeyType, ValType, DictValType, PolicyType>* level = this->getLevel(l);
+            if constexpr (PolicyType::merge == MERGE_MIN_OVERLAP) {
+                if (l + 1 < this->getNumLevels()) return this->pickMinOverlapRun(l);
+            }
+            if (!level->compactionCursor) return 0;
+            for (size_t r = 0; r < level->runs.size(); r++) {
+                if (*level->compactionCursor < this->getKey(level->runs[r], 0)) return r;
+            }
+            return 0;
+        }
+
+        // `pickMinOverlapRun()`
+        // Returns the run of level l whose key range overlaps the fewest pairs in level l + 1.
+        size_t pickMinOverlapRun(size_t l) {
+            const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = this->getLevel(l)->runs;
+            const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& next = this->getLevel(l + 1)->runs;
+            size_t best = 0, bestOverlap = std::numeric_limits<size_t>::max();
+            for (size_t r = 0; r < runs.size(); r++) {
+                KeyType runMin = this->getKey(runs[r], 0), runMax = this->getKey(runs[r], runs[r]->numPairs - 1);
+                size_t overlap = 0;
+                for (size_t n = next.empty() ? 0 : this->findRunIndex(l + 1, runMin); n < next.size() && !(runMax < this->getKey(next[n], 0)); n++) {
+                    if (!(this->getKey(next[n], next[n]->numPairs - 1) < runMin)) overlap += next[n]->numPairs;
+                }
+                if (overlap < bestOverlap) {
+                    best = r;
+                    bestOverlap = overlap;
+                }
+            }
+            return best;
+        }
+
+        // `compactRun()`
+        // Moves run r of level l (l >= 1) into level l + 1, together with the range tombstones in the
+        // key span owned by the run. If the level has no runs, only its range tombstones are moved.
+        void compactRun(size_t l, size_t r) {
+            Level<KeyType, ValType, DictValType, PolicyType>* level = this->getLevel(l);
+            std::vector<MergeEntry> entries;
+            size_t tombstonesSince = std::numeric_limits<size_t>::max();
+            RangeTombstones<KeyType> moved;
+
+            if (level->runs.empty()) {
+                moved = level->rangeTombstones.extract(std::nullopt, std::nullopt);
+            } else {
+                Run<KeyType, ValType, DictValType, PolicyType>* run = level->runs[r];
+                std::optional<KeyType> lo, hi;
+                if (r > 0) lo = this->getKey(run, 0);
+                if (r + 1 < level->runs.size()) hi = this->getKey(level->runs[r + 1], 0);
+                moved = level->rangeTombstones.extract(lo, hi);
+
+                entries.reserve(run->numPairs);
+                for (size_t i = 0; i < run->numPairs; i++) {
+                    entries.push_back(this->readEntry(run, i));
+                }
+                tombstonesSince = run->tombstonesSince;
+                level->compactionCursor = this->getKey(run, run->numPairs - 1);
+                this->stats.level(l).bytesRead += this->runBytes(run);
+                level->runs.erase(level->runs.begin() + r);
+                this->deleteRun(run);
+            }
+
+            size_t rangeTombstonesSince = level->rangeTombstonesSince;
+            if (level->rangeTombstones.empty()) level->rangeTombstonesSince = std::numeric_limits<size_t>::max();
+            this->mergeInto(l + 1, entries, tombstonesSince, moved, rangeTombstonesSince);
         }
 
-        // `propagateData()`
-        // Moves all of the data at level l to level l + 1, then wipes level l.
-        void propagateData(size_t l) {
-            for (size_t i = 0; i < this->getPairsInLevel(l); i++) {
-                this->appendPair(l + 1, this->getKey(l, i), this->getVal(l, i), this->getTomb(l, i));
+        // `mergePartition()`
+        // Merges the incoming entries newer[newerBegin, newerEnd) with the runs [runBegin, runEnd) of level
+        // l, writing the result into new runs appended to `outputs`. Newer entries win ties, and older
+        // entries covered by the incoming range tombstones are dropped. Safe to run concurrently on
+        // disjoint partitions: it only reads the inputs and writes to the runs it creates.
+        //
+        // An incoming operand is applied to the older entry of its key, which it replaces (see
+        // `applyOperand()`), and an operand reaching the last level becomes a put, as nothing is older.
+        //
+        // With FILTER_CUCKOO it also lists the changes to the level filter in `changes`, for the caller to
+        // apply: incoming keys move down from level l - 1 (or are added, coming from the buffer, which is
+        // taken out of the filter as it is flushed), and dropped entries are removed. Entries of level l
+        // that are only rewritten keep their entries.
+        void mergePartition(size_t l, const std::vector<MergeEntry>& newer, size_t newerBegin, size_t newerEnd,
+                            const std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs, size_t runBegin, size_t runEnd,
+                            const RangeTombstones<KeyType>& moved, bool lastLevel, size_t tombstonesSince, double fpr,
+                            std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& outputs, std::vector<LevelChange>& changes) {
+            Run<KeyType, ValType, DictValType, PolicyType>* out = nullptr;
+            // `emit()` returns false if the entry is dropped.
+            auto emit = [&](const MergeEntry& entry) {
+                if (entry.isDelete && lastLevel) return false;
+                if (out == nullptr || out->numPairs == out->capacity) {
+                    out = this->createRun(this->getRunCapacity(), fpr);
+                    outputs.push_back(out);
+                }
+                if (entry.isOperand && lastLevel) this->appendEntry(out, {entry.key, entry.val, false, false});
+                else this->appendEntry(out, entry);
+                return true;
+            };
+            size_t above = l == 1 ? LevelFilter::NO_LEVEL : l - 1, none = LevelFilter::NO_LEVEL;
+            auto change = [&](const KeyType& key, size_t from, size_t to) {
+                if constexpr (PolicyType::filter == FILTER_CUCKOO) {
+                    if (from != to) changes.push_back({bloomHash(key).h1, from, to});
+                }
+            };
+
+            // Two-way merge of the incoming entries with the concatenation of the runs, which is already
+            // sorted since the runs are disjoint and ordered.
+            size_t i = newerBegin, r = runBegin, j = 0;
+            while (i < newerEnd || r < runEnd) {
+                if (r < runEnd && j == runs[r]->numPairs) {
+                    r++;
+                    j = 0;
+                    continue;
+                }
+                if (r == runEnd) {
+                    change(newer[i].key, above, emit(newer[i]) ? l : none);
+                    i++;
+                    continue;
+                }
+                MergeEntry older = this->readEntry(runs[r], j);
+                if (moved.covers(older.key)) {
+                    change(older.key, l, none);
+                    this->discardEntry(runs[r], j++);
+                } else if (i == newerEnd || older.key < newer[i].key) {
+                    if (!emit(older)) change(older.key, l, none);
+                    j++;
+                } else if (newer[i].key < older.key) {
+                    change(newer[i].key, above, emit(newer[i]) ? l : none);
+                    i++;
+                } else {
+                    // The key keeps the entry of level l if the newer entry, or the older one with the newer
+                    // operand applied, takes the older one's place.
+                    change(newer[i].key, above, none);
+                    if (newer[i].isOperand) {
+                        if (!emit(this->applyOperand(older, newer[i++]))) change(older.key, l, none);
+                        j++;
+                    } else {
+                        if (!emit(newer[i++])) change(older.key, l, none);
+                        this->discardEntry(runs[r], j++);
+                    }
+                }
+            }
+
+            for (Run<KeyType, ValType, DictValType, PolicyType>* output : outputs) {
+                this->constructFence(output);
+                if (output->numTombstones > 0) output->tombstonesSince = std::min(output->tombstonesSince, tombstonesSince);
             }
-            this->clearLevel(l);
-            this->sortLevel(l + 1);
         }
 
-        // `propogateLevel()`
-        // Writes all the KV pairs from level l to level l + 1, then resets level l.
-        void propagateLevel(size_t l) {
-            if (l == this->getNumLevels() - 1) {
-                // We need to initialize a new level at the bottom of the tree then copy everything into it.
-                KeyType* keysPointer = mmapLevel<KeyType>(("data/k" + std::to_string(l + 1) + ".data").c_str(), l + 1);
-                void* valsPointer = nullptr;
-                if (ENCODING_TYPE == ENCODING_OFF) valsPointer = mmapLevel<ValType>(("data/v" + std::to_string(l + 1) + ".data").c_str(), l + 1);
-                else if (ENCODING_TYPE == ENCODING_DICT) valsPointer = mmapLevel<DictValType>(("data/v" + std::to_string(l + 1) + ".data").c_str(), l + 1);
-                bool* tombstonePointer = mmapLevel<bool>(("data/t" + std::to_string(l + 1) + ".data").c_str(), l + 1);
-                this->initializeLevel(l + 1, keysPointer, valsPointer, tombstonePointer, 0);
+        // `mergeInto()`
+        // Merges sorted, deduplicated entries coming down from level l - 1 into level l. Only the runs
+        // of level l overlapping the incoming keys or range tombstones are rewritten; the merged output
+        // is split into new runs of at most `getRunCapacity()` pairs that replace them. Entries of level
+        // l covered by the incoming range tombstones are dropped. On the last level, point tombstones
+        // are dropped and the range tombstones are discarded since there is nothing older left to shadow.
+        void mergeInto(size_t l, const std::vector<MergeEntry>& newer, size_t tombstonesSince,
+                       const RangeTombstones<KeyType>& moved, size_t rangeTombstonesSince) {
+            if (newer.empty() && moved.empty()) return;
+            if (l == this->getNumLevels()) this->initializeLevel(l);
+            auto start = std::chrono::steady_clock::now();
+            bool lastLevel = l == this->getNumLevels() - 1;
+            Level<KeyType, ValType, DictValType, PolicyType>* level = this->getLevel(l);
+            std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>& runs = level->runs;
+
+            // Find the block of runs [first, last) to rewrite: every run overlapping the incoming keys or
+            // ranges, plus the runs lying between them so that the new runs never straddle an untouched run.
+            auto overlaps = [&](Run<KeyType, ValType, DictValType, PolicyType>* run) {
+                KeyType runMin = this->getKey(run, 0), runMax = this->getKey(run, run->numPairs - 1);
+                if (!newer.empty() && runMin <= newer.back().key && newer.front().key <= runMax) return true;
+                for (const auto& range : moved) {
+                    if (runMin < range.second && range.first <= runMax) return true;
+                }
+                return false;
+            };
+            std::optional<size_t> first, last;
+            for (size_t r = 0; r < runs.size(); r++) {
+                if (!overlaps(runs[r])) continue;
+                if (!first) first = r;
+                last = r + 1;
+            }
+            if (!newer.empty()) {
+                // The position the incoming keys take among the runs: after every run ending before them.
+                size_t position = 0;
+                while (position < runs.size() && this->getKey(runs[position], runs[position]->numPairs - 1) < newer.front().key) position++;
+                first = first ? std::min(*first, position) : position;
+                last = last ? std::max(*last, position) : position;
+            }
+            if (!first) first = last = 0;
+
+            for (size_t r = *first; r < *last; r++) {
+                tombstonesSince = std::min(tombstonesSince, runs[r]->tombstonesSince);
+            }
+
+            // Split the merge into subcompactions at the first keys of the rewritten runs, and run them in
+            // parallel. Partition p merges the incoming entries below the next partition's first key with
+            // its own runs, and the outputs are concatenated in key order.
+            size_t numRuns = *last - *first;
+            size_t numPartitions = std::max<size_t>(1, std::min(numRuns, this->compactionPool->numThreads()));
+            if (newer.size() + numRuns * this->getRunCapacity() < SUBCOMPACTION_MIN_PAIRS) numPartitions = 1;
+            if constexpr (PolicyType::encoding == ENCODING_VLOG) {
+                // Applying operands appends to the value log, which merges running in parallel must not do.
+                bool operands = std::any_of(newer.begin(), newer.end(), [](const MergeEntry& entry) { return entry.isOperand; });
+                for (size_t r = *first; r < *last; r++) operands |= runs[r]->numOperands > 0;
+                if (operands) numPartitions = 1;
+            }
+            std::vector<size_t> runBounds, newerBounds;
+            for (size_t p = 0; p <= numPartitions; p++) {
+                size_t runBound = *first + p * numRuns / numPartitions;
+                runBounds.push_back(runBound);
+                if (p == 0) newerBounds.push_back(0);
+                else if (p == numPartitions) newerBounds.push_back(newer.size());
+                else {
+                    KeyType splitKey = this->getKey(runs[runBound], 0);
+                    newerBounds.push_back(std::lower_bound(newer.begin(), newer.end(), splitKey, [](const MergeEntry& entry, KeyType key) {
+                        return entry.key < key;
+                    }) - newer.begin());
+                }
+            }
+
+            double fpr = this->bloomFpr(l);
+            std::vector<std::vector<Run<KeyType, ValType, DictValType, PolicyType>*>> partitionOutputs(numPartitions);
+            std::vector<std::vector<LevelChange>> partitionChanges(numPartitions);
+            // The page faults of each partition are those of the thread merging it, so merges of other
+            // trees sharing the process do not count towards this level.
+            std::vector<rusage> partitionFaults(numPartitions);
+            auto runPartition = [&](size_t p) {
+                rusage before;
+                getrusage(RUSAGE_THREAD, &before);
+                this->mergePartition(l, newer, newerBounds[p], newerBounds[p + 1], runs, runBounds[p], runBounds[p + 1],
+                                     moved, lastLevel, tombstonesSince, fpr, partitionOutputs[p], partitionChanges[p]);
+                getrusage(RUSAGE_THREAD, &partitionFaults[p]);
+                partitionFaults[p].ru_minflt -= before.ru_minflt;
+                partitionFaults[p].ru_majflt -= before.ru_majflt;
+            };
+            if (numPartitions == 1) {
+                runPartition(0);
+            } else {
+                std::vector<std::future<void>> done;
+                for (size_t p = 0; p < numPartitions; p++) {
+                    done.push_back(this->compactionPool->submit([&runPartition, p] { runPartition(p); }));
+                }
+                for (std::future<void>& partition : done) partition.get();
+                this->stats.subcompactions += numPartitions;
+            }
+            std::vector<Run<KeyType, ValType, DictValType, PolicyType>*> outputs;
+            for (const auto& partition : partitionOutputs) outputs.insert(outputs.end(), partition.begin(), partition.end());
+
+            this->stats.compactions++;
+            this->stats.compactionRunsRewritten += *last - *first;
+            LevelStats& levelStats = this->stats.level(l);
+            size_t entriesIn = newer.size(), tombstonesIn = 0, entriesOut = 0, tombstonesOut = 0, bytesMerged = 0;
+            for (const MergeEntry& entry : newer) tombstonesIn += entry.isDelete;
+            for (size_t r = *first; r < *last; r++) {
+                entriesIn += runs[r]->numPairs;
+                tombstonesIn += runs[r]->numTombstones;
+                bytesMerged += this->runBytes(runs[r]);
+            }
+            levelStats.bytesRead += bytesMerged;
+            for (Run<KeyType, ValType, DictValType, PolicyType>* run : outputs) {
+                entriesOut += run->numPairs;
+                tombstonesOut += run->numTombstones;
+                levelStats.bytesWritten += this->runBytes(run);
+                bytesMerged += this->runBytes(run);
+            }
+            this->compactionLimiter.charge(bytesMerged);
+            levelStats.compactions++;
+            levelStats.entriesMerged += entriesIn;
+            levelStats.tombstonesDropped += tombstonesIn - tombstonesOut;
+            levelStats.entriesDropped += (entriesIn - entriesOut) - (tombstonesIn - tombstonesOut);
+            for (size_t r = *first; r < *last; r++) this->deleteRun(runs[r]);
+            runs.erase(runs.begin() + *first, runs.begin() + *last);
+            runs.insert(runs.begin() + *first, outputs.begin(), outputs.end());
+            for (const auto& partition : partitionChanges) {
+                for (const LevelChange& change : partition) this->levelFilter.update(change.hash, change.from, change.to);
+            }
+
+            if (!lastLevel && !moved.empty()) {
+                level->rangeTombstones.merge(moved);
+                level->rangeTombstonesSince = std::min(level->rangeTombstonesSince, rangeTombstonesSince);
+            }
+
+            for (const rusage& faults : partitionFaults) {
+                levelStats.minorFaults += faults.ru_minflt;
+                levelStats.majorFaults += faults.ru_majflt;
             }
-            this->propagateData(l);
+            levelStats.compactionSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
         }
 };
 
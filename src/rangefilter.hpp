@@ -0,0 +1,126 @@
+#ifndef RANGEFILTER_HPP
+#define RANGEFILTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+
+#include "Types.hpp"
+
+// `rangeFilterable`
+// Whether keys of a type have an order-preserving 64-bit image, see `rangeKey()`. Runs of other key
+// types get no range filter and are always searched.
+template<typename KeyType>
+constexpr bool rangeFilterable = std::is_integral_v<KeyType> || std::is_same_v<KeyType, std::string>;
+
+// `rangeKey()`
+// Maps a key to 64 bits so that a < b implies rangeKey(a) <= rangeKey(b). Integers map exactly, with
+// the sign bit flipped so that negative keys come first. Strings map to their first 8 bytes, so keys
+// sharing those bytes share an image.
+template<typename KeyType>
+uint64_t rangeKey(const KeyType& key) {
+    if constexpr (std::is_same_v<KeyType, std::string>) {
+        uint64_t image = 0;
+        for (size_t i = 0; i < sizeof(uint64_t); i++) image = (image << 8) | (i < key.size() ? static_cast<unsigned char>(key[i]) : 0);
+        return image;
+    } else if constexpr (std::is_signed_v<KeyType>) {
+        return static_cast<uint64_t>(static_cast<int64_t>(key)) ^ (static_cast<uint64_t>(1) << 63);
+    } else {
+        return static_cast<uint64_t>(key);
+    }
+}
+
+// `RangeFilter`
+// Answers whether a run may hold a key in [a, b), as in Rosetta: a bloom filter holds the prefixes of
+// every key's image at RANGE_FILTER_LEVELS granularities, each RANGE_FILTER_STRIDE bits coarser than
+// the last. A query starts at the coarsest level that splits the range and walks down, only refining
+// the prefixes the filter holds, so an empty range is usually ruled out after a few probes. Once
+// RANGE_FILTER_MAX_PROBES probes are spent the run is assumed to overlap.
+//
+// A query makes several probes, so the filter is blocked: all the bits of a prefix are set in one
+// 64-bit word, and a probe costs one cache miss however many bits it checks.
+class RangeFilter {
+    private:
+        std::vector<uint64_t> words;
+        size_t numHashes;
+
+        // `RangeFilter::mix()`
+        // The finalizer of SplitMix64.
+        static uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ull;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebull;
+            x ^= x >> 31;
+            return x;
+        }
+
+        // `RangeFilter::mask()`
+        // Returns the word holding the prefix at `level` and the bits it sets in that word.
+        std::pair<size_t, uint64_t> mask(uint64_t prefix, size_t level) const {
+            uint64_t hash = mix(prefix ^ mix(level + 1));
+            size_t word = static_cast<size_t>((static_cast<unsigned __int128>(hash) * this->words.size()) >> 64);
+            uint64_t bits = 0, positions = mix(hash);
+            for (size_t i = 0; i < this->numHashes; i++, positions >>= 6) bits |= static_cast<uint64_t>(1) << (positions & 63);
+            return {word, bits};
+        }
+
+        bool holds(uint64_t prefix, size_t level) const {
+            auto [word, bits] = this->mask(prefix, level);
+            return (this->words[word] & bits) == bits;
+        }
+
+        // `RangeFilter::mayOverlap()`
+        // Probes the prefixes of `level` covering [lo, hi], refining each one the filter holds.
+        bool mayOverlap(uint64_t lo, uint64_t hi, size_t level, size_t& probes) const {
+            size_t shift = level * RANGE_FILTER_STRIDE;
+            uint64_t low = (static_cast<uint64_t>(1) << shift) - 1;
+            for (uint64_t prefix = lo >> shift; ; prefix++) {
+                if (++probes > RANGE_FILTER_MAX_PROBES) return true;
+                if (this->holds(prefix, level)) {
+                    if (level == 0) return true;
+                    uint64_t first = std::max(lo, prefix << shift), last = std::min(hi, (prefix << shift) | low);
+                    if (this->mayOverlap(first, last, level - 1, probes)) return true;
+                }
+                if (prefix == hi >> shift) return false;
+            }
+        }
+
+    public:
+        // The hashes are cut from one 64-bit word, 6 bits each.
+        RangeFilter(size_t numBits, size_t numHashFunctions)
+            : words(std::max<size_t>(1, (numBits + 63) / 64)), numHashes(std::min<size_t>(std::max<size_t>(1, numHashFunctions), 10)) {}
+
+        void add(uint64_t image) {
+            for (size_t level = 0; level < RANGE_FILTER_LEVELS; level++) {
+                auto [word, bits] = this->mask(image >> (level * RANGE_FILTER_STRIDE), level);
+                this->words[word] |= bits;
+            }
+        }
+
+        // `RangeFilter::mayContain()`
+        // Returns false only if no key added has an image in [lo, hi]. Coarse levels where the whole
+        // range falls under one prefix are skipped as long as a finer level also splits it in at most
+        // two prefixes, since a short range would almost always find its one coarse prefix present.
+        bool mayContain(uint64_t lo, uint64_t hi) const {
+            if (hi < lo) return false;
+            size_t level = RANGE_FILTER_LEVELS - 1;
+            while (level > 0 && (hi >> ((level - 1) * RANGE_FILTER_STRIDE)) - (lo >> ((level - 1) * RANGE_FILTER_STRIDE)) < 2) level--;
+            size_t probes = 0;
+            return this->mayOverlap(lo, hi, level, probes);
+        }
+
+        void clear() {
+            std::fill(this->words.begin(), this->words.end(), 0);
+        }
+
+        size_t numBits() const {
+            return this->words.size() * 64;
+        }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef RANGE_TOMBSTONE_H
+#define RANGE_TOMBSTONE_H
+
+#include <map>
+#include <iterator>
+#include <optional>
+
+// `RangeTombstones`
+// A set of deleted key ranges [start, end). Overlapping and adjacent ranges are coalesced on insert
+// so that the set is always a sorted list of disjoint intervals, and `covers()` is a single lookup.
+template<typename KeyType>
+class RangeTombstones {
+    private:
+        // Maps the start of each range to its exclusive end.
+        std::map<KeyType, KeyType> ranges;
+
+    public:
+        // `RangeTombstones::add()`
+        // Adds the range [start, end), merging it with any ranges it overlaps or touches.
+        void add(KeyType start, KeyType end) {
+            if (!(start < end)) return;
+            auto it = this->ranges.upper_bound(start);
+            if (it != this->ranges.begin() && !(std::prev(it)->second < start)) {
+                --it;
+                if (it->second < end) it->second = end;
+                start = it->first;
+                end = it->second;
+            } else {
+                it = this->ranges.emplace(start, end).first;
+            }
+            // Swallow any later ranges that now overlap [start, end).
+            auto next = std::next(it);
+            while (next != this->ranges.end() && !(end < next->first)) {
+                if (end < next->second) end = next->second;
+                next = this->ranges.erase(next);
+            }
+            it->second = end;
+        }
+
+        // `RangeTombstones::covers()`
+        // Returns whether the key falls inside one of the deleted ranges.
+        bool covers(KeyType key) const {
+            auto it = this->ranges.upper_bound(key);
+            if (it == this->ranges.begin()) return false;
+            return key < std::prev(it)->second;
+        }
+
+        // `RangeTombstones::overlaps()`
+        // Returns whether any deleted range shares a key with [first, last], both bounds included.
+        bool overlaps(KeyType first, KeyType last) const {
+            auto it = this->ranges.upper_bound(last);
+            if (it == this->ranges.begin()) return false;
+            return first < std::prev(it)->second;
+        }
+
+        // `RangeTombstones::merge()`
+        // Adds all the ranges from another set into this one.
+        void merge(const RangeTombstones& other) {
+            for (const auto& range : other.ranges) this->add(range.first, range.second);
+        }
+
+        // `RangeTombstones::extract()`
+        // Removes the parts of the ranges that fall inside [lo, hi) and returns them. A missing bound
+        // is unbounded on that side. Used to hand the range tombstones over a key span to the next level.
+        RangeTombstones extract(std::optional<KeyType> lo, std::optional<KeyType> hi) {
+            RangeTombstones extracted;
+            std::map<KeyType, KeyType> kept;
+            for (const auto& [start, end] : this->ranges) {
+                KeyType innerStart = (lo && start < *lo) ? *lo : start;
+                KeyType innerEnd = (hi && *hi < end) ? *hi : end;
+                if (innerStart < innerEnd) {
+                    extracted.ranges.emplace(innerStart, innerEnd);
+                    if (start < innerStart) kept.emplace(start, innerStart);
+                    if (innerEnd < end) kept.emplace(innerEnd, end);
+                } else {
+                    kept.emplace(start, end);
+                }
+            }
+            this->ranges.swap(kept);
+            return extracted;
+        }
+
+        void clear() { this->ranges.clear(); }
+        bool empty() const { return this->ranges.empty(); }
+        size_t size() const { return this->ranges.size(); }
+        typename std::map<KeyType, KeyType>::const_iterator begin() const { return this->ranges.begin(); }
+        typename std::map<KeyType, KeyType>::const_iterator end() const { return this->ranges.end(); }
+};
+
+#endif
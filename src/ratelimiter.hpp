@@ -0,0 +1,83 @@
+#ifndef RATELIMITER_HPP
+#define RATELIMITER_HPP
+
+#include <cstddef>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "Types.hpp"
+
+// `CompactionLimiter`
+// A token bucket of merge bytes, refilled at `rate` bytes per second and holding up to
+// COMPACTION_BURST_BYTES, that decides which lanes may merge (see `CompactionLane`). Flushes always run
+// but are charged like every other merge, so heavy ingest leaves fewer tokens for the levels beneath.
+// Merges out of level 1 run while the bucket holds any tokens, and deeper merges only while it holds
+// more than COMPACTION_DEEP_RESERVE of a full bucket, which keeps the rest for level 1. The bucket is
+// only refilled by `refill()` as a flush begins, never while its merges run, since they would earn
+// tokens as fast as they spend them: a flush spends at most what it found in the bucket.
+//
+// With a COMPACTION_PAUSE_TARGET_NS, the rate tunes itself to the pauses that writes take to flush the
+// buffer and run the merges after it. Every COMPACTION_TUNE_WINDOW pauses, it is halved if their p99
+// missed the target, and raised by a tenth if it did not or if any of the pauses stalled: a rate too
+// low to keep up with the writes only trades paced merges for stalls, which hold writes up as long.
+// It stays within [COMPACTION_RATE_MIN, COMPACTION_RATE_MAX].
+class CompactionLimiter {
+    private:
+        double rate;
+        double tokens = COMPACTION_BURST_BYTES;
+        std::chrono::steady_clock::time_point refilled = std::chrono::steady_clock::now();
+        std::vector<double> pauses;
+        bool stalled = false;
+        double pauseP99 = 0;
+
+    public:
+        // A rate of 0 admits every merge.
+        CompactionLimiter(double rate) : rate(rate) {}
+
+        // `CompactionLimiter::refill()`
+        // Adds the tokens earned since the last refill.
+        void refill() {
+            auto now = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(now - this->refilled).count();
+            this->tokens = std::min<double>(COMPACTION_BURST_BYTES, this->tokens + seconds * this->rate);
+            this->refilled = now;
+        }
+
+        // `CompactionLimiter::admit()`
+        // Whether a merge in this lane may run now.
+        bool admit(CompactionLane lane) {
+            if (this->rate == 0 || lane == COMPACTION_FLUSH) return true;
+            return this->tokens > (lane == COMPACTION_L1 ? 0 : COMPACTION_DEEP_RESERVE * COMPACTION_BURST_BYTES);
+        }
+
+        // `CompactionLimiter::charge()`
+        // Takes the bytes a merge read and wrote out of the bucket, which may leave it in debt.
+        void charge(size_t bytes) {
+            if (this->rate == 0) return;
+            this->tokens -= bytes;
+        }
+
+        // `CompactionLimiter::observePause()`
+        // Records how long a write was held up by a flush and the merges after it, and whether any of
+        // those merges ran because a level reached its stall ratio.
+        void observePause(double nanoseconds, bool stalled) {
+            if (this->rate == 0 || COMPACTION_PAUSE_TARGET_NS == 0) return;
+            this->pauses.push_back(nanoseconds);
+            this->stalled |= stalled;
+            if (this->pauses.size() < COMPACTION_TUNE_WINDOW) return;
+            auto p99 = this->pauses.begin() + this->pauses.size() * 99 / 100;
+            std::nth_element(this->pauses.begin(), p99, this->pauses.end());
+            this->pauseP99 = *p99;
+            this->rate = this->pauseP99 > COMPACTION_PAUSE_TARGET_NS && !this->stalled ? this->rate / 2 : this->rate * 1.1;
+            this->rate = std::clamp<double>(this->rate, COMPACTION_RATE_MIN, COMPACTION_RATE_MAX);
+            this->pauses.clear();
+            this->stalled = false;
+        }
+
+        double getRate() const { return this->rate; }
+        // The p99 of the last window of pauses, or 0 before the first window is full.
+        double getPauseP99() const { return this->pauseP99; }
+};
+
+#endif
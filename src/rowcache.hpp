@@ -0,0 +1,117 @@
+#ifndef ROWCACHE_HPP
+#define ROWCACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <optional>
+#include <functional>
+
+// `RowCache`
+// The results of recent gets: the value of each key, or that it has none, so that repeated gets skip
+// the levels entirely. It caches what a key reads rather than where its entry is, so merges never
+// invalidate it; the tree erases keys as they are written instead.
+//
+// Like a CPU cache, it is split by key hash into sets of WAYS slots and a key can only be held in its
+// own set, so a lookup scans a few adjacent slots without allocating or chasing pointers. Each set
+// evicts with CLOCK: a hit only sets the reference bit of its slot, and an insert into a full set
+// sweeps the hand past referenced slots, clearing their bits, and takes the first unreferenced one.
+template<typename KeyType, typename ValType>
+class RowCache {
+    private:
+        static constexpr size_t WAYS = 8;
+
+        struct Slot {
+            KeyType key;
+            std::optional<ValType> val;
+        };
+        struct Set {
+            Slot slots[WAYS];
+            // One bit per slot.
+            uint8_t used = 0;
+            uint8_t referenced = 0;
+            uint8_t hand = 0;
+        };
+
+        std::vector<Set> sets;
+        size_t setBits = 0;
+
+        Set& setOf(const KeyType& key) {
+            uint64_t hash = static_cast<uint64_t>(std::hash<KeyType>{}(key)) * 0x9e3779b97f4a7c15ull;
+            return this->sets[this->setBits == 0 ? 0 : hash >> (64 - this->setBits)];
+        }
+
+        static int wayOf(const Set& set, const KeyType& key) {
+            for (size_t w = 0; w < WAYS; w++) {
+                if ((set.used >> w & 1) && set.slots[w].key == key) return w;
+            }
+            return -1;
+        }
+
+        static void release(Set& set, size_t w) {
+            set.used &= ~(1u << w);
+            set.referenced &= ~(1u << w);
+            set.slots[w].val.reset();
+        }
+
+    public:
+        // The capacity is rounded down to a power of two sets.
+        RowCache(size_t capacity) {
+            if (capacity < WAYS) return;
+            while (static_cast<size_t>(2) << this->setBits <= capacity / WAYS) this->setBits++;
+            this->sets.resize(static_cast<size_t>(1) << this->setBits);
+        }
+
+        // `RowCache::find()`
+        // Returns the cached result for `key`, which is empty if the key has no value, or nullptr if
+        // the key is not cached.
+        const std::optional<ValType>* find(const KeyType& key) {
+            if (this->sets.empty()) return nullptr;
+            Set& set = this->setOf(key);
+            int w = wayOf(set, key);
+            if (w < 0) return nullptr;
+            set.referenced |= 1u << w;
+            return &set.slots[w].val;
+        }
+
+        // `RowCache::insert()`
+        // Caches the result of a get, evicting a key of its set if the set is full.
+        void insert(const KeyType& key, const std::optional<ValType>& val) {
+            if (this->sets.empty()) return;
+            Set& set = this->setOf(key);
+            int w = wayOf(set, key);
+            if (w < 0 && set.used != (1u << WAYS) - 1) {
+                w = __builtin_ctz(~set.used);
+            } else if (w < 0) {
+                while (set.referenced >> set.hand & 1) {
+                    set.referenced &= ~(1u << set.hand);
+                    set.hand = (set.hand + 1) % WAYS;
+                }
+                w = set.hand;
+                set.hand = (set.hand + 1) % WAYS;
+            }
+            set.used |= 1u << w;
+            set.slots[w].key = key;
+            set.slots[w].val = val;
+        }
+
+        void erase(const KeyType& key) {
+            if (this->sets.empty()) return;
+            Set& set = this->setOf(key);
+            if (set.used == 0) return;
+            int w = wayOf(set, key);
+            if (w >= 0) release(set, w);
+        }
+
+        // `RowCache::eraseRange()`
+        // Erases every cached key in [leftBound, rightBound).
+        void eraseRange(const KeyType& leftBound, const KeyType& rightBound) {
+            for (Set& set : this->sets) {
+                for (size_t w = 0; w < WAYS; w++) {
+                    if ((set.used >> w & 1) && !(set.slots[w].key < leftBound) && set.slots[w].key < rightBound) release(set, w);
+                }
+            }
+        }
+};
+
+#endif
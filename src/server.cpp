@@ -10,31 +10,50 @@
 #include <fcntl.h>
 #include <cmath>
 #include <iomanip>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <cerrno>
 
 #include "Types.hpp"
 #include "Utils.hpp"
 #include "lsm.hpp"
+#include "sharded.hpp"
+#include "keyspaces.hpp"
 
-// `main()`
-// Run `./server` to start up the LSM tree. See `Types.hpp` to change the encoding type, testing switch,
-// buffer pages, size ratio, and other knobs.
-int main() {
-    std::cout << "\nStarting up server...\n" << std::endl;
-
-    LSM<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE> lsm;
-
-    if (ENCODING_TYPE == ENCODING_OFF) std::cout << "Encoding type: ENCODING_OFF" << std::endl;
-    else if (ENCODING_TYPE == ENCODING_DICT) std::cout << "Encoding type: ENCODING_DICT" << std::endl;
-    if (TESTING_SWITCH == TESTING_OFF) std::cout << "Testing: TESTING_OFF" << std::endl;
-    else if (TESTING_SWITCH == TESTING_ON) std::cout << "Encoding type: TESTING_ON" << std::endl;
-    std::cout << "Buffer size: " << lsm.getBufferSize() << std::endl;
-    std::cout << "Size ratio: " << SIZE_RATIO << std::endl;
-    std::cout << "Bloom target FPR: " << BLOOM_TARGET_FPR << "\n" << std::endl;
-    std::cout << std::fixed << std::setprecision(0) << std::endl;
+// `parseGet()`
+// Returns whether the command is a get, setting `key` to the key it looks up.
+bool parseGet(const std::string& userCommand, KEY_TYPE& key) {
+    std::vector<std::string> tokens = parseCommand(userCommand);
+    return tokens.size() == 2 && tokens[0] == "g" && parseToken(tokens[1], key);
+}
 
+// `serve()`
+// Runs the commands read from stdin against the tree until a shutdown command, then shuts it down.
+// Works for `Keyspaces` of single trees and for a `ShardedLSM`. A get is answered together with the gets queued
+// right behind it that have already been read into the stdin buffer, see `multiGet()`.
+template<typename Tree>
+void serve(Tree& lsm) {
     std::string userCommand;
+    // Set when `userCommand` was read ahead while gathering gets and has not been run yet.
+    bool held = false;
     auto start = std::chrono::high_resolution_clock::now();
-    while (std::getline(std::cin, userCommand)) {
+    while (held || std::getline(std::cin, userCommand)) {
+        held = false;
+        KEY_TYPE key;
+        if (parseGet(userCommand, key)) {
+            std::vector<KEY_TYPE> keys = {key};
+            while (keys.size() < GET_BATCH_MAX && std::cin.rdbuf()->in_avail() > 0 && std::getline(std::cin, userCommand)) {
+                if (!parseGet(userCommand, key)) {
+                    held = true;
+                    break;
+                }
+                keys.push_back(key);
+            }
+            for (const auto& [status, replyMessage] : lsm.multiGet(SUCCESS, keys)) std::cout << replyMessage << std::endl;
+            continue;
+        }
+
         std::string replyMessage;
         Status status;
         std::tie(status, replyMessage) = lsm.processCommand(userCommand);
@@ -47,9 +66,167 @@ int main() {
 
     if (ENCODING_TYPE == ENCODING_OFF) std::cout << "Encoding type: ENCODING_OFF" << std::endl;
     else if (ENCODING_TYPE == ENCODING_DICT) std::cout << "Encoding type: ENCODING_DICT" << std::endl;
+    else if (ENCODING_TYPE == ENCODING_VLOG) std::cout << "Encoding type: ENCODING_VLOG" << std::endl;
     if (TESTING_SWITCH == TESTING_OFF) std::cout << "Testing: TESTING_OFF" << std::endl;
     else if (TESTING_SWITCH == TESTING_ON) std::cout << "Encoding type: TESTING_ON" << std::endl;
     lsm.printStats();
     lsm.shutdownServer(userCommand);
+}
+
+// `popLine()`
+// Moves the first complete line of `pending` into `line`, without its line ending. Returns false if
+// `pending` holds no complete line.
+bool popLine(std::string& pending, std::string& line) {
+    size_t newline = pending.find('\n');
+    if (newline == std::string::npos) return false;
+    line = pending.substr(0, newline);
+    pending.erase(0, newline + 1);
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+    return true;
+}
+
+// `serveConnection()`
+// Runs the commands read from one client socket, one per line, and writes each reply followed by a
+// newline. Commands on a tree that is not thread safe are serialized with `treeMutex`. Consecutive
+// gets that arrived together are answered with one `multiGet()`. Returns the shutdown command if the
+// client sent one, or an empty string if it disconnected.
+template<typename Tree>
+std::string serveConnection(Tree& lsm, int clientFd, std::mutex& treeMutex) {
+    std::string pending, userCommand;
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(clientFd, buffer, sizeof(buffer), 0)) > 0) {
+        pending.append(buffer, received);
+        std::string replies;
+        bool held = false;
+        while (held || popLine(pending, userCommand)) {
+            held = false;
+            if (userCommand.empty()) continue;
+
+            KEY_TYPE key;
+            if (parseGet(userCommand, key)) {
+                std::vector<KEY_TYPE> keys = {key};
+                while (keys.size() < GET_BATCH_MAX && popLine(pending, userCommand)) {
+                    if (!parseGet(userCommand, key)) {
+                        held = true;
+                        break;
+                    }
+                    keys.push_back(key);
+                }
+                std::unique_lock<std::mutex> lock(treeMutex, std::defer_lock);
+                if (!Tree::threadSafe) lock.lock();
+                for (const auto& [status, replyMessage] : lsm.multiGet(SUCCESS, keys)) replies += replyMessage + "\n";
+                continue;
+            }
+
+            std::string replyMessage;
+            Status status;
+            {
+                std::unique_lock<std::mutex> lock(treeMutex, std::defer_lock);
+                if (!Tree::threadSafe) lock.lock();
+                std::tie(status, replyMessage) = lsm.processCommand(userCommand);
+            }
+            replies += replyMessage + "\n";
+            if (userCommand == "s" || userCommand == "sw") {
+                send(clientFd, replies.data(), replies.size(), MSG_NOSIGNAL);
+                return userCommand;
+            }
+        }
+        if (send(clientFd, replies.data(), replies.size(), MSG_NOSIGNAL) < 0) break;
+    }
+    return "";
+}
+
+// `listenAndServe()`
+// Serves clients connecting to `port` over TCP, each on its own thread, until one of them sends a
+// shutdown command, then shuts the tree down.
+template<typename Tree>
+void listenAndServe(Tree& lsm, int port) {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int enable = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(port);
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(listenFd, SOMAXCONN) < 0) {
+        std::cerr << "Failed to listen on port " << port << ": " << strerror(errno) << std::endl;
+        close(listenFd);
+        return;
+    }
+    std::cout << "Listening on port " << port << std::endl;
+
+    std::mutex treeMutex, clientsMutex;
+    std::vector<std::thread> connections;
+    std::vector<int> clientFds;
+    std::string userCommand;
+    auto start = std::chrono::high_resolution_clock::now();
+    int clientFd;
+    while ((clientFd = accept(listenFd, nullptr, nullptr)) >= 0) {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        clientFds.push_back(clientFd);
+        connections.emplace_back([&lsm, &treeMutex, &clientsMutex, &userCommand, listenFd, clientFd] {
+            std::string command = serveConnection(lsm, clientFd, treeMutex);
+            if (!command.empty()) {
+                std::lock_guard<std::mutex> lock(clientsMutex);
+                if (userCommand.empty()) userCommand = command;
+                // Wakes the accept loop up.
+                shutdown(listenFd, SHUT_RDWR);
+            }
+        });
+    }
+
+    // Disconnect the remaining clients so that their threads finish.
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for (int fd : clientFds) shutdown(fd, SHUT_RDWR);
+    }
+    for (std::thread& connection : connections) connection.join();
+    for (int fd : clientFds) close(fd);
+    close(listenFd);
+    if (userCommand.empty()) userCommand = "s";
+
+    auto end = std::chrono::high_resolution_clock::now();
+    auto runtime = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    std::cout << "total runtime: " << runtime.count() << " ms" << std::endl;
+    lsm.printStats();
+    lsm.shutdownServer(userCommand);
+}
+
+// `main()`
+// Run `./server` to start up the LSM tree reading commands from stdin, or `./server --listen [port]`
+// to serve clients over TCP on `port` (`PORT` by default). See `Types.hpp` to change the encoding
+// type, testing switch, buffer pages, size ratio, number of shards, and other knobs.
+int main(int argc, char** argv) {
+    int port = -1;
+    if (argc >= 2 && std::string(argv[1]) == "--listen") port = argc >= 3 ? std::stoi(argv[2]) : PORT;
+
+    // Reading stdin through its own buffer lets `serve()` see which commands are already queued. Clients
+    // served over TCP run on several threads, which needs the synchronized streams. Otherwise only one
+    // thread may write to `std::cout` at a time, shard workers included.
+    if (port < 0) std::ios::sync_with_stdio(false);
+
+    std::cout << "\nStarting up server...\n" << std::endl;
+
+    if (ENCODING_TYPE == ENCODING_OFF) std::cout << "Encoding type: ENCODING_OFF" << std::endl;
+    else if (ENCODING_TYPE == ENCODING_DICT) std::cout << "Encoding type: ENCODING_DICT" << std::endl;
+    else if (ENCODING_TYPE == ENCODING_VLOG) std::cout << "Encoding type: ENCODING_VLOG" << std::endl;
+    if (TESTING_SWITCH == TESTING_OFF) std::cout << "Testing: TESTING_OFF" << std::endl;
+    else if (TESTING_SWITCH == TESTING_ON) std::cout << "Encoding type: TESTING_ON" << std::endl;
+    std::cout << "Buffer size: " << BUFFER_PAGES * PAGE_SIZE << std::endl;
+    std::cout << "Size ratio: " << SIZE_RATIO << std::endl;
+    std::cout << "Bloom target FPR: " << BLOOM_TARGET_FPR << "\n" << std::endl;
+    std::cout << std::fixed << std::setprecision(0) << std::endl;
+
+    if (NUM_SHARDS == 1) {
+        Keyspaces<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE> lsm;
+        if (port >= 0) listenAndServe(lsm, port);
+        else serve(lsm);
+    } else {
+        ShardedLSM<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE> lsm;
+        std::cout << "Shards: " << lsm.getNumShards() << "\n" << std::endl;
+        if (port >= 0) listenAndServe(lsm, port);
+        else serve(lsm);
+    }
     return 0;
 }
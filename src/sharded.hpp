@@ -0,0 +1,372 @@
+#ifndef SHARDED_HPP
+#define SHARDED_HPP
+
+#include <string>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <future>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+#include "lsm.hpp"
+#include "threadpool.hpp"
+#include "MurmurHash3.hpp"
+
+// `Shard`
+// One independent LSM tree stored in its own data subfolder. All the commands for a shard run in
+// order on its single worker thread, so the tree itself needs no locking.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType>
+struct Shard {
+    std::unique_ptr<LSM<KeyType, ValType, DictValType, PolicyType>> lsm;
+    std::unique_ptr<ThreadPool> worker;
+};
+
+// `ShardedLSM`
+// Partitions the key space across several LSM trees and routes each command to the shards owning its
+// keys. Writes are queued on the shard workers without waiting, reads wait for their answers, and
+// ranges are answered by the overlapping shards in parallel and merged. See `Types.hpp` for the knobs.
+template<typename KeyType, typename ValType, typename DictValType, typename PolicyType = Policy<>>
+class ShardedLSM {
+    private:
+        std::string dataDirectory;
+        size_t numShards = NUM_SHARDS > 0 ? NUM_SHARDS : std::max(1u, std::thread::hardware_concurrency());
+        ShardingType shardingType = SHARDING_TYPE;
+        KeyType shardKeyMin = SHARD_KEY_MIN;
+        KeyType shardKeyMax = SHARD_KEY_MAX;
+        // Runs the subcompactions of every shard, so merges share the cores rather than each shard
+        // starting a pool of its own.
+        std::unique_ptr<ThreadPool> compactionPool;
+        std::vector<Shard<KeyType, ValType, DictValType, PolicyType>> shards;
+        // Ranges are counted here since a single range is split across shards.
+        Stats stats;
+        std::mutex statsMutex;
+
+    public:
+        // Commands may be issued from several threads at once: every shard only runs on its worker.
+        static constexpr bool threadSafe = true;
+
+        ShardedLSM(std::string dataDirectory = "data") : dataDirectory(dataDirectory) {
+            this->compactionPool = std::make_unique<ThreadPool>(COMPACTION_THREADS > 0 ? COMPACTION_THREADS : std::max(1u, std::thread::hardware_concurrency()));
+            this->populateShards();
+        }
+
+        // `populateShards()`
+        // Opens every shard. A persisted database keeps the layout it was created with, which is
+        // recorded in `shards.data` as the number of shards, the sharding type, and, for integral keys,
+        // the key bounds.
+        void populateShards(void) {
+            if (!std::filesystem::exists(this->dataDirectory)) std::filesystem::create_directories(this->dataDirectory);
+
+            std::ifstream shardsFile(this->dataDirectory + "/shards.data");
+            size_t numShards = 0;
+            int shardingType = 0;
+            if (shardsFile >> numShards >> shardingType) {
+                this->numShards = numShards;
+                this->shardingType = static_cast<ShardingType>(shardingType);
+                // The key bounds are only used, and only recorded, for integral keys.
+                if constexpr (std::is_integral_v<KeyType>) shardsFile >> this->shardKeyMin >> this->shardKeyMax;
+            }
+            shardsFile.close();
+            assert(this->numShards > 0);
+            if constexpr (std::is_integral_v<KeyType>) assert(this->shardKeyMin < this->shardKeyMax);
+
+            size_t numCores = std::max(1u, std::thread::hardware_concurrency());
+            for (size_t i = 0; i < this->numShards; i++) {
+                Shard<KeyType, ValType, DictValType, PolicyType> shard;
+                shard.lsm = std::make_unique<LSM<KeyType, ValType, DictValType, PolicyType>>(this->dataDirectory + "/shard" + std::to_string(i), this->compactionPool.get());
+                shard.worker = std::make_unique<ThreadPool>(1);
+                shard.worker->submit([i, numCores] { pinThreadToCore(i % numCores); });
+                this->shards.push_back(std::move(shard));
+            }
+        }
+
+        // `shutdownServer()`
+        // Waits for all queued commands, then shuts down every shard. `s` also records the shard
+        // layout, while `sw` wipes the whole data folder. The shards shut down one after another since
+        // each one reports to `std::cout`, which is not synchronized when reading stdin (see `main()`).
+        void shutdownServer(std::string userCommand) {
+            for (size_t i = 0; i < this->getNumShards(); i++) {
+                this->runOnShard(i, [userCommand](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { lsm->shutdownServer(userCommand); return 0; });
+            }
+            this->shards.clear();
+
+            if (userCommand == "sw") {
+                std::filesystem::remove_all(this->dataDirectory);
+            } else {
+                std::ofstream shardsFile(this->dataDirectory + "/shards.data", std::ios::out | std::ios::trunc);
+                shardsFile << this->numShards << " " << this->shardingType;
+                if constexpr (std::is_integral_v<KeyType>) shardsFile << " " << this->shardKeyMin << " " << this->shardKeyMax;
+                shardsFile << std::endl;
+                shardsFile.close();
+            }
+        }
+
+        void printStats(void) {
+            ::printStats(this->getStats());
+        }
+
+        // `getStats()`
+        // Returns the stats of every shard added together, levels included.
+        Stats getStats(void) {
+            Stats total;
+            {
+                std::lock_guard<std::mutex> lock(this->statsMutex);
+                total = this->stats;
+            }
+            for (size_t i = 0; i < this->getNumShards(); i++) {
+                total += this->runOnShard(i, [](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { return lsm->getStats(); });
+            }
+            return total;
+        }
+
+        // `put()`
+        // Queues a put or delete on the shard owning the key without waiting for it.
+        std::tuple<Status, std::string> put(Status status, KeyType key, ValType val, bool isDelete) {
+            size_t i = this->shardOf(key);
+            LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+            this->shards[i].worker->submit([lsm, status, key, val, isDelete] { lsm->put(status, key, val, isDelete); });
+            return std::make_tuple(status, "");
+        }
+
+        // `add()`
+        // Queues an add on the shard owning the key without waiting for it, like `put()`.
+        std::tuple<Status, std::string> add(Status status, KeyType key, ValType delta) {
+            size_t i = this->shardOf(key);
+            LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+            this->shards[i].worker->submit([lsm, status, key, delta] { lsm->add(status, key, delta); });
+            return std::make_tuple(status, "");
+        }
+
+        // `deleteRange()`
+        // Queues the range delete on every shard that may hold keys in [leftBound, rightBound).
+        std::tuple<Status, std::string> deleteRange(Status status, KeyType leftBound, KeyType rightBound) {
+            if (!(leftBound < rightBound)) return std::make_tuple(status, "");
+            auto [first, last] = this->shardsInRange(leftBound, rightBound);
+            for (size_t i = first; i <= last; i++) {
+                LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+                this->shards[i].worker->submit([lsm, status, leftBound, rightBound] { lsm->deleteRange(status, leftBound, rightBound); });
+            }
+            return std::make_tuple(status, "");
+        }
+
+        // `get()`
+        // Looks the key up on its shard once the shard has applied every earlier command.
+        std::tuple<Status, std::string> get(Status status, KeyType key) {
+            return this->runOnShard(this->shardOf(key), [status, key](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { return lsm->get(status, key); });
+        }
+
+        // `multiGet()`
+        // Splits the keys by shard and looks each shard's keys up with `LSM::multiGet()`, all shards in
+        // parallel, once they have applied every earlier command.
+        std::vector<std::tuple<Status, std::string>> multiGet(Status status, const std::vector<KeyType>& keys) {
+            std::vector<std::vector<KeyType>> shardKeys(this->getNumShards());
+            std::vector<std::vector<size_t>> shardIndexes(this->getNumShards());
+            for (size_t j = 0; j < keys.size(); j++) {
+                size_t i = this->shardOf(keys[j]);
+                shardKeys[i].push_back(keys[j]);
+                shardIndexes[i].push_back(j);
+            }
+
+            std::vector<std::vector<std::tuple<Status, std::string>>> shardReplies(this->getNumShards());
+            std::vector<std::future<void>> done;
+            for (size_t i = 0; i < this->getNumShards(); i++) {
+                if (shardKeys[i].empty()) continue;
+                LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+                const std::vector<KeyType>* batch = &shardKeys[i];
+                std::vector<std::tuple<Status, std::string>>* replies = &shardReplies[i];
+                done.push_back(this->shards[i].worker->submit([lsm, status, batch, replies] { *replies = lsm->multiGet(status, *batch); }));
+            }
+            for (std::future<void>& shard : done) shard.wait();
+
+            std::vector<std::tuple<Status, std::string>> replies(keys.size());
+            for (size_t i = 0; i < this->getNumShards(); i++) {
+                for (size_t j = 0; j < shardIndexes[i].size(); j++) replies[shardIndexes[i][j]] = std::move(shardReplies[i][j]);
+            }
+            return replies;
+        }
+
+        // `range()`
+        // Collects [leftBound, rightBound) from the overlapping shards in parallel. Each key lives on
+        // exactly one shard, so the partial results are disjoint.
+        std::tuple<Status, std::string> range(Status status, KeyType leftBound, KeyType rightBound) {
+            std::map<KeyType, ValType> results;
+            if (leftBound < rightBound) {
+                auto [first, last] = this->shardsInRange(leftBound, rightBound);
+                std::vector<std::map<KeyType, ValType>> partials(last - first + 1);
+                std::vector<std::future<void>> done;
+                for (size_t i = first; i <= last; i++) {
+                    LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+                    std::map<KeyType, ValType>* partial = &partials[i - first];
+                    done.push_back(this->shards[i].worker->submit([lsm, partial, leftBound, rightBound] { lsm->collectRange(leftBound, rightBound, *partial, false); }));
+                }
+                for (size_t i = 0; i < done.size(); i++) {
+                    done[i].wait();
+                    results.merge(partials[i]);
+                }
+            }
+
+            std::cout << "Range query bounds: [" << leftBound << ", " << rightBound << "], Range query size: " << results.size() << std::endl;
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            this->stats.ranges++;
+            this->stats.rangeLengthSum += results.size();
+            if constexpr (std::is_arithmetic_v<ValType>) {
+                if (TESTING_SWITCH == TESTING_ON) {
+                    for (const auto& pair : results) {
+                        this->stats.rangeValueSum = (this->stats.rangeValueSum + pair.second) % static_cast<int64_t>(std::pow(10, 6));
+                    }
+                }
+            }
+            return std::make_tuple(status, mapToString(results));
+        }
+
+        // `limitRange()`
+        // Scans the first limit + 1 pairs of every overlapping shard in parallel and keeps the first
+        // `limit` of them overall, so each shard stops early as in `LSM::scanRange()`.
+        std::tuple<Status, std::string> limitRange(Status status, KeyType leftBound, KeyType rightBound, size_t limit, bool reverse) {
+            std::vector<std::pair<KeyType, ValType>> results;
+            if (leftBound < rightBound) {
+                auto [first, last] = this->shardsInRange(leftBound, rightBound);
+                std::vector<std::vector<std::pair<KeyType, ValType>>> partials(last - first + 1);
+                std::vector<std::future<void>> done;
+                for (size_t i = first; i <= last; i++) {
+                    LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+                    std::vector<std::pair<KeyType, ValType>>* partial = &partials[i - first];
+                    done.push_back(this->shards[i].worker->submit([lsm, partial, leftBound, rightBound, limit, reverse] {
+                        *partial = lsm->scanRange(leftBound, rightBound, limit + 1, reverse);
+                    }));
+                }
+                for (size_t i = 0; i < done.size(); i++) {
+                    done[i].wait();
+                    results.insert(results.end(), partials[i].begin(), partials[i].end());
+                }
+                std::sort(results.begin(), results.end(), [reverse](const auto& a, const auto& b) { return reverse ? b.first < a.first : a.first < b.first; });
+                if (results.size() > limit + 1) results.resize(limit + 1);
+            }
+
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            this->stats.ranges++;
+            this->stats.rangeLengthSum += std::min(results.size(), limit);
+            return std::make_tuple(status, pageToString(results, limit, reverse));
+        }
+
+        // `rangeAggregate()`
+        // Aggregates [leftBound, rightBound) on the overlapping shards in parallel and combines the
+        // partial aggregates, which cover disjoint keys.
+        std::tuple<Status, std::string> rangeAggregate(Status status, KeyType leftBound, KeyType rightBound) {
+            Aggregate<ValType> total;
+            if (leftBound < rightBound) {
+                auto [first, last] = this->shardsInRange(leftBound, rightBound);
+                std::vector<Aggregate<ValType>> partials(last - first + 1);
+                std::vector<std::future<void>> done;
+                for (size_t i = first; i <= last; i++) {
+                    LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+                    Aggregate<ValType>* partial = &partials[i - first];
+                    done.push_back(this->shards[i].worker->submit([lsm, partial, leftBound, rightBound] { *partial = lsm->aggregateRange(leftBound, rightBound); }));
+                }
+                for (size_t i = 0; i < done.size(); i++) {
+                    done[i].wait();
+                    total += partials[i];
+                }
+            }
+            std::lock_guard<std::mutex> lock(this->statsMutex);
+            this->stats.rangeAggregates++;
+            return std::make_tuple(status, aggregateToString(total));
+        }
+
+        void printLevels(std::string userCommand) {
+            for (size_t i = 0; i < this->getNumShards(); i++) {
+                std::cout << "\n======= Shard " << i << " =======" << std::endl;
+                this->runOnShard(i, [userCommand](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { lsm->printLevels(userCommand); return 0; });
+            }
+        }
+
+        std::tuple<Status, std::string> processCommand(std::string userCommand) {
+
+            Status status = SUCCESS;
+
+            if (userCommand == "p" || userCommand == "pv") {
+                printLevels(userCommand);
+                return std::make_tuple(status, "Printed levels to server.");
+            }
+
+            // Tokenize the command.
+            std::vector<std::string> tokens = parseCommand(userCommand);
+            if (tokens.empty()) return std::make_tuple(ERROR, "Empty command.");
+            KeyType key, rightBound;
+            ValType val;
+            size_t limit;
+            bool reverse;
+
+            if (tokens[0] == "p" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], val)) {
+                return put(status, key, val, false);
+            } else if (tokens[0] == "a" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], val)) {
+                return add(status, key, val);
+            } else if (tokens[0] == "g" && tokens.size() == 2 && parseToken(tokens[1], key)) {
+                return get(status, key);
+            } else if (tokens[0] == "r" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return range(status, key, rightBound);
+            } else if (tokens[0] == "r" && parseRangeLimit(tokens, limit, reverse) && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return limitRange(status, key, rightBound, limit, reverse);
+            } else if (tokens[0] == "ra" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return rangeAggregate(status, key, rightBound);
+            } else if (tokens[0] == "d" && tokens.size() == 2 && parseToken(tokens[1], key)) {
+                return put(status, key, ValType(), true);
+            } else if (tokens[0] == "dr" && tokens.size() == 3 && parseToken(tokens[1], key) && parseToken(tokens[2], rightBound)) {
+                return deleteRange(status, key, rightBound);
+            } else if (tokens[0] == "stats" && (tokens.size() == 1 || (tokens.size() == 2 && tokens[1] == "json"))) {
+                return std::make_tuple(status, statsToString(this->getStats(), tokens.size() == 2));
+            } else if (tokens[0] == "k") {
+                // Knobs are set on every shard, and shard 0 replies.
+                for (size_t i = this->getNumShards() - 1; i > 0; i--) {
+                    this->runOnShard(i, [userCommand](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { return lsm->processCommand(userCommand); });
+                }
+            }
+            // Shutdown commands and the help message are the same as for a single tree.
+            return this->runOnShard(0, [userCommand](LSM<KeyType, ValType, DictValType, PolicyType>* lsm) { return lsm->processCommand(userCommand); });
+        }
+
+        size_t getNumShards() { return this->numShards; }
+
+        // `shardOf()`
+        // Returns the shard owning the key. Keys outside [shardKeyMin, shardKeyMax] belong to the
+        // first or last shard. Range sharding needs integral keys, so other keys are always hashed.
+        size_t shardOf(KeyType key) {
+            if constexpr (std::is_integral_v<KeyType>) {
+                if (this->shardingType == SHARD_BY_RANGE) {
+                    if (key < this->shardKeyMin) return 0;
+                    if (this->shardKeyMax < key) return this->getNumShards() - 1;
+                    uint64_t width = (static_cast<uint64_t>(this->shardKeyMax) - static_cast<uint64_t>(this->shardKeyMin)) / this->getNumShards() + 1;
+                    return (static_cast<uint64_t>(key) - static_cast<uint64_t>(this->shardKeyMin)) / width;
+                }
+            }
+            // The seed differs from the ones used by the bloom filters so the two stay independent.
+            return hashKey(key, SHARD_HASH_SEED) % this->getNumShards();
+        }
+
+        // `shardsInRange()`
+        // Returns the first and last shard that may hold keys in [leftBound, rightBound). With hash
+        // sharding that is every shard.
+        std::pair<size_t, size_t> shardsInRange(KeyType leftBound, KeyType rightBound) {
+            if constexpr (std::is_integral_v<KeyType>) {
+                if (this->shardingType == SHARD_BY_RANGE) return {this->shardOf(leftBound), this->shardOf(rightBound - 1)};
+            }
+            return {0, this->getNumShards() - 1};
+        }
+
+        // `runOnShard()`
+        // Runs `function` on the worker of shard `i` after its queued commands and returns the result.
+        template<typename Function>
+        auto runOnShard(size_t i, Function function) {
+            LSM<KeyType, ValType, DictValType, PolicyType>* lsm = this->shards[i].lsm.get();
+            decltype(function(lsm)) result;
+            this->shards[i].worker->submit([&result, &function, lsm] { result = function(lsm); }).wait();
+            return result;
+        }
+};
+
+#endif
@@ -0,0 +1,303 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Types.hpp"
+
+// `LevelStats`
+// Counters for one level. A merge is charged to the level it writes into, except for the bytes read
+// from the run it moves down, which are charged to the level above.
+struct LevelStats {
+    // The shape of the level, filled in when the stats are read.
+    size_t runs = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+
+    size_t compactions = 0;
+    double compactionSeconds = 0;
+    // Bytes of runs read by merges: runs moved out of this level and runs of this level rewritten.
+    size_t bytesRead = 0;
+    size_t bytesWritten = 0;
+    // Entries fed into merges into this level, and those the merges dropped: obsolete versions and
+    // entries deleted by tombstones, and tombstones with nothing left to delete.
+    size_t entriesMerged = 0;
+    size_t entriesDropped = 0;
+    size_t tombstonesDropped = 0;
+    // Pages searched or scanned by gets and ranges.
+    size_t pageReads = 0;
+    // Pages that range aggregates answered from their summaries without reading them.
+    size_t pagesSummarized = 0;
+    // Runs that ranges skipped because their range filters ruled them out.
+    size_t rangeFilterSkips = 0;
+    // Page faults taken by the threads running the merges into this level.
+    size_t minorFaults = 0;
+    size_t majorFaults = 0;
+
+    LevelStats& operator+=(const LevelStats& other) {
+        this->runs += other.runs;
+        this->entries += other.entries;
+        this->bytes += other.bytes;
+        this->compactions += other.compactions;
+        this->compactionSeconds += other.compactionSeconds;
+        this->bytesRead += other.bytesRead;
+        this->bytesWritten += other.bytesWritten;
+        this->entriesMerged += other.entriesMerged;
+        this->entriesDropped += other.entriesDropped;
+        this->tombstonesDropped += other.tombstonesDropped;
+        this->pageReads += other.pageReads;
+        this->rangeFilterSkips += other.rangeFilterSkips;
+        this->pagesSummarized += other.pagesSummarized;
+        this->minorFaults += other.minorFaults;
+        this->majorFaults += other.majorFaults;
+        return *this;
+    }
+};
+
+// `Stats`
+// Counters collected over a session and printed on shutdown.
+struct Stats {
+    size_t puts = 0;
+    // Read-modify-write operands written by `a` commands.
+    size_t adds = 0;
+    size_t successfulGets = 0;
+    size_t failedGets = 0;
+    size_t ranges = 0;
+    size_t rangeAggregates = 0;
+    double rangeLengthSum = 0;
+    int64_t rangeValueSum = 0; // This is modulo 10**6 since it could get very large.
+    size_t searchLevelCalls = 0;
+    size_t bloomTruePositives = 0;
+    size_t bloomFalsePositives = 0;
+    size_t deletes = 0;
+    size_t rangeDeletes = 0;
+    size_t tombstoneCompactions = 0;
+    size_t compactions = 0;
+    size_t compactionRunsRewritten = 0;
+    size_t subcompactions = 0;
+    // Flushes after which the compaction limiter left a level over its capacity, and merges run because
+    // a level reached its stall ratio. With a compaction rate, also the current rate in bytes per second
+    // and the p99 pause of flushing writes, filled in when the stats are read.
+    size_t compactionsDeferred = 0;
+    size_t compactionStalls = 0;
+    double compactionRate = 0;
+    double compactionPauseP99 = 0;
+    // The bytes of the keys and values written by puts, adds, and deletes.
+    size_t bytesPut = 0;
+    // With VLOG encoding: the bytes held by the value log (filled in when the stats are read), the bytes
+    // appended to it, the part of those copied by garbage collection, and the segments collected.
+    size_t valueLogBytes = 0;
+    size_t valueLogBytesWritten = 0;
+    size_t valueLogBytesRelocated = 0;
+    size_t valueLogSegmentsCollected = 0;
+    // Gets answered from the row cache, and gets that missed it and searched the levels.
+    size_t rowCacheHits = 0;
+    size_t rowCacheMisses = 0;
+    std::vector<LevelStats> levels;
+
+    LevelStats& level(size_t l) {
+        if (this->levels.size() <= l) this->levels.resize(l + 1);
+        return this->levels[l];
+    }
+
+    // `Stats::writeAmplification()`
+    // The bytes written to the levels beneath the buffer and to the value log per byte put.
+    double writeAmplification() const {
+        size_t written = this->valueLogBytesWritten;
+        for (const LevelStats& level : this->levels) written += level.bytesWritten;
+        return this->bytesPut == 0 ? 0 : static_cast<double>(written) / this->bytesPut;
+    }
+
+    // `Stats::readAmplification()`
+    // The pages read per get, range, or range aggregate.
+    double readAmplification() const {
+        size_t pageReads = 0;
+        for (const LevelStats& level : this->levels) pageReads += level.pageReads;
+        size_t lookups = this->successfulGets + this->failedGets + this->ranges + this->rangeAggregates;
+        return lookups == 0 ? 0 : static_cast<double>(pageReads) / lookups;
+    }
+
+    // `Stats::rowCacheHitRatio()`
+    // The fraction of gets answered from the row cache.
+    double rowCacheHitRatio() const {
+        size_t lookups = this->rowCacheHits + this->rowCacheMisses;
+        return lookups == 0 ? 0 : static_cast<double>(this->rowCacheHits) / lookups;
+    }
+
+    // `Stats::spaceAmplification()`
+    // The bytes stored beneath the buffer per byte of the last level, which holds about one version
+    // of every key.
+    double spaceAmplification() const {
+        size_t stored = 0;
+        for (size_t l = 1; l < this->levels.size(); l++) stored += this->levels[l].bytes;
+        if (this->levels.size() < 2 || this->levels.back().bytes == 0) return 0;
+        return static_cast<double>(stored) / this->levels.back().bytes;
+    }
+
+    // Adds the counters of another instance, e.g. to total the stats of several shards.
+    Stats& operator+=(const Stats& other) {
+        this->puts += other.puts;
+        this->adds += other.adds;
+        this->successfulGets += other.successfulGets;
+        this->failedGets += other.failedGets;
+        this->ranges += other.ranges;
+        this->rangeAggregates += other.rangeAggregates;
+        this->rangeLengthSum += other.rangeLengthSum;
+        this->rangeValueSum = (this->rangeValueSum + other.rangeValueSum) % static_cast<int64_t>(std::pow(10, 6));
+        this->searchLevelCalls += other.searchLevelCalls;
+        this->bloomTruePositives += other.bloomTruePositives;
+        this->bloomFalsePositives += other.bloomFalsePositives;
+        this->deletes += other.deletes;
+        this->rangeDeletes += other.rangeDeletes;
+        this->tombstoneCompactions += other.tombstoneCompactions;
+        this->compactions += other.compactions;
+        this->compactionRunsRewritten += other.compactionRunsRewritten;
+        this->subcompactions += other.subcompactions;
+        this->compactionsDeferred += other.compactionsDeferred;
+        this->compactionStalls += other.compactionStalls;
+        this->compactionRate += other.compactionRate;
+        this->compactionPauseP99 = std::max(this->compactionPauseP99, other.compactionPauseP99);
+        this->bytesPut += other.bytesPut;
+        this->valueLogBytes += other.valueLogBytes;
+        this->valueLogBytesWritten += other.valueLogBytesWritten;
+        this->valueLogBytesRelocated += other.valueLogBytesRelocated;
+        this->valueLogSegmentsCollected += other.valueLogSegmentsCollected;
+        this->rowCacheHits += other.rowCacheHits;
+        this->rowCacheMisses += other.rowCacheMisses;
+        for (size_t l = 0; l < other.levels.size(); l++) this->level(l) += other.levels[l];
+        return *this;
+    }
+};
+
+// `levelStatsToString()`
+// Formats the counters of level l as `name=value` pairs, or as a JSON object.
+std::string levelStatsToString(const LevelStats& level, size_t l, bool json) {
+    std::ostringstream ss;
+    const char* separator = json ? ", " : " ";
+    auto field = [&](const char* name, auto value, bool first = false) {
+        if (!first) ss << separator;
+        if (json) ss << "\"" << name << "\": " << value;
+        else ss << name << "=" << value;
+    };
+    if (json) {
+        ss << "{";
+        field("level", l, true);
+    } else {
+        ss << "Level " << l << ":";
+    }
+    field("runs", level.runs);
+    field("entries", level.entries);
+    field("bytes", level.bytes);
+    field("compactions", level.compactions);
+    field("compaction_seconds", level.compactionSeconds);
+    field("bytes_read", level.bytesRead);
+    field("bytes_written", level.bytesWritten);
+    field("entries_merged", level.entriesMerged);
+    field("entries_dropped", level.entriesDropped);
+    field("tombstones_dropped", level.tombstonesDropped);
+    field("page_reads", level.pageReads);
+    field("range_filter_skips", level.rangeFilterSkips);
+    field("pages_summarized", level.pagesSummarized);
+    field("minor_faults", level.minorFaults);
+    field("major_faults", level.majorFaults);
+    if (json) ss << "}";
+    return ss.str();
+}
+
+// `valueLogStatsToString()`
+// Formats the value log counters, which are only used with VLOG encoding.
+std::string valueLogStatsToString(const Stats& stats) {
+    std::ostringstream ss;
+    ss << "Value log: bytes=" << stats.valueLogBytes << " bytes_written=" << stats.valueLogBytesWritten
+       << " bytes_relocated=" << stats.valueLogBytesRelocated << " segments_collected=" << stats.valueLogSegmentsCollected;
+    return ss.str();
+}
+
+// `rowCacheStatsToString()`
+// Formats the row cache counters.
+std::string rowCacheStatsToString(const Stats& stats) {
+    std::ostringstream ss;
+    ss << "Row cache: hits=" << stats.rowCacheHits << " misses=" << stats.rowCacheMisses << " hit_ratio=" << stats.rowCacheHitRatio();
+    return ss.str();
+}
+
+// `compactionLimiterStatsToString()`
+// Formats the compaction limiter counters, which are only used with a compaction rate.
+std::string compactionLimiterStatsToString(const Stats& stats) {
+    std::ostringstream ss;
+    ss << "Compaction limiter: rate=" << stats.compactionRate << " deferred=" << stats.compactionsDeferred
+       << " stalls=" << stats.compactionStalls << " pause_p99_ns=" << stats.compactionPauseP99;
+    return ss.str();
+}
+
+// `statsToString()`
+// Formats the stats for the `stats` command: the operation counts, the amplification, and a line per
+// level. With `json` set it is a single-line JSON object instead.
+std::string statsToString(const Stats& stats, bool json) {
+    std::ostringstream ss;
+    if (json) {
+        ss << "{\"puts\": " << stats.puts << ", \"adds\": " << stats.adds << ", \"deletes\": " << stats.deletes << ", \"range_deletes\": " << stats.rangeDeletes
+           << ", \"successful_gets\": " << stats.successfulGets << ", \"failed_gets\": " << stats.failedGets << ", \"ranges\": " << stats.ranges
+           << ", \"range_aggregates\": " << stats.rangeAggregates
+           << ", \"bytes_put\": " << stats.bytesPut << ", \"compactions\": " << stats.compactions
+           << ", \"write_amplification\": " << stats.writeAmplification() << ", \"read_amplification\": " << stats.readAmplification()
+           << ", \"space_amplification\": " << stats.spaceAmplification() << ", \"value_log_bytes\": " << stats.valueLogBytes
+           << ", \"value_log_bytes_written\": " << stats.valueLogBytesWritten << ", \"value_log_bytes_relocated\": " << stats.valueLogBytesRelocated
+           << ", \"value_log_segments_collected\": " << stats.valueLogSegmentsCollected << ", \"row_cache_hits\": " << stats.rowCacheHits
+           << ", \"row_cache_misses\": " << stats.rowCacheMisses << ", \"row_cache_hit_ratio\": " << stats.rowCacheHitRatio()
+           << ", \"compaction_rate\": " << stats.compactionRate << ", \"compactions_deferred\": " << stats.compactionsDeferred
+           << ", \"compaction_stalls\": " << stats.compactionStalls << ", \"compaction_pause_p99_ns\": " << stats.compactionPauseP99 << ", \"levels\": [";
+        for (size_t l = 0; l < stats.levels.size(); l++) ss << (l > 0 ? ", " : "") << levelStatsToString(stats.levels[l], l, true);
+        ss << "]}";
+    } else {
+        ss << "Puts: " << stats.puts << " Adds: " << stats.adds << " Deletes: " << stats.deletes << " Range deletes: " << stats.rangeDeletes
+           << " Gets: " << stats.successfulGets + stats.failedGets << " Ranges: " << stats.ranges << " Range aggregates: " << stats.rangeAggregates << " Compactions: " << stats.compactions
+           << "\nWrite amplification: " << stats.writeAmplification() << " Read amplification: " << stats.readAmplification()
+           << " Space amplification: " << stats.spaceAmplification();
+        if (stats.valueLogBytesWritten > 0) ss << "\n" << valueLogStatsToString(stats);
+        if (stats.rowCacheHits + stats.rowCacheMisses > 0) ss << "\n" << rowCacheStatsToString(stats);
+        if (stats.compactionRate > 0) ss << "\n" << compactionLimiterStatsToString(stats);
+        for (size_t l = 0; l < stats.levels.size(); l++) ss << "\n" << levelStatsToString(stats.levels[l], l, false);
+    }
+    return ss.str();
+}
+
+// `printStats()`
+// Prints the session statistics.
+void printStats(const Stats& stats) {
+    // std::cout << "\n ——— Session statistics ——— \n" << std::endl;
+    std::cout << "\nPuts: " << stats.puts << std::endl;
+    std::cout << "Adds: " << stats.adds << std::endl;
+    std::cout << "Successful gets: " << stats.successfulGets << std::endl;
+    std::cout << "Failed gets: " << stats.failedGets << std::endl;
+    std::cout << "Ranges: " << stats.ranges << std::endl;
+    std::cout << "Range aggregates: " << stats.rangeAggregates << std::endl;
+    std::cout << "Sum length of all ranges: " << stats.rangeLengthSum << std::endl;
+    std::cout << "Range Value Sum % 10^6: " << stats.rangeValueSum << std::endl;
+    // std::cout << "Calls to searchLevel(): " << stats.searchLevelCalls << std::endl;
+    // std::cout << "Bloom true positives: " << stats.bloomTruePositives << std::endl;
+    // std::cout << "Bloom false positives: " << stats.bloomFalsePositives << std::endl;
+    std::cout << "Bloom FPR: " << (float)stats.bloomFalsePositives / (float)(stats.bloomFalsePositives + (stats.searchLevelCalls - stats.bloomTruePositives)) << std::endl;
+    std::cout << "Deletes: " << stats.deletes << std::endl;
+    std::cout << "Range deletes: " << stats.rangeDeletes << std::endl;
+    std::cout << "Compactions: " << stats.compactions << ". Runs rewritten: " << stats.compactionRunsRewritten << ". Parallel subcompactions: " << stats.subcompactions << std::endl;
+    std::cout << "Tombstone compactions: " << stats.tombstoneCompactions << std::endl;
+    // Formatted apart from `std::cout`, whose precision the server sets to whole numbers.
+    std::ostringstream amplification;
+    amplification << "Write amplification: " << stats.writeAmplification() << ". Read amplification: " << stats.readAmplification()
+                  << ". Space amplification: " << stats.spaceAmplification();
+    std::cout << amplification.str() << std::endl;
+    if (stats.valueLogBytesWritten > 0) std::cout << valueLogStatsToString(stats) << std::endl;
+    if (stats.rowCacheHits + stats.rowCacheMisses > 0) std::cout << rowCacheStatsToString(stats) << std::endl;
+    if (stats.compactionRate > 0) std::cout << compactionLimiterStatsToString(stats) << std::endl;
+    for (size_t l = 0; l < stats.levels.size(); l++) std::cout << levelStatsToString(stats.levels[l], l, false) << std::endl;
+    // std::cout << "\n —————————————————————————— \n" << std::endl;
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+
+// `ThreadPool`
+// A fixed set of worker threads that run submitted tasks in FIFO order. Used to run the
+// subcompactions of a merge in parallel.
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::queue<std::packaged_task<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable available;
+        bool stopping = false;
+
+        void work() {
+            while (true) {
+                std::packaged_task<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->available.wait(lock, [this] { return this->stopping || !this->tasks.empty(); });
+                    if (this->stopping && this->tasks.empty()) return;
+                    task = std::move(this->tasks.front());
+                    this->tasks.pop();
+                }
+                task();
+            }
+        }
+
+    public:
+        ThreadPool(size_t numThreads) {
+            for (size_t i = 0; i < numThreads; i++) {
+                this->workers.emplace_back(&ThreadPool::work, this);
+            }
+        }
+
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopping = true;
+            }
+            this->available.notify_all();
+            for (std::thread& worker : this->workers) worker.join();
+        }
+
+        // `ThreadPool::submit()`
+        // Queues a task and returns a future that becomes ready once the task has run.
+        std::future<void> submit(std::function<void()> function) {
+            std::packaged_task<void()> task(std::move(function));
+            std::future<void> done = task.get_future();
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->tasks.push(std::move(task));
+            }
+            this->available.notify_one();
+            return done;
+        }
+
+        size_t numThreads() {
+            return this->workers.size();
+        }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef TUNER_HPP
+#define TUNER_HPP
+
+#include <cstddef>
+#include <cmath>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#include "Types.hpp"
+#include "stats.hpp"
+
+// `Knobs`
+// The tuning parameters of a tree that can change at runtime. They are persisted in the catalog.
+struct Knobs {
+    // The page size is the number of entries in a page.
+    size_t pageSize = PAGE_SIZE;
+    // bufferPages is the number of pages in the buffer.
+    size_t bufferPages = BUFFER_PAGES;
+    // filePages is the number of pages in each run beneath the buffer.
+    size_t filePages = FILE_PAGES;
+    size_t sizeRatio = SIZE_RATIO;
+    double bloomTargetFpr = BLOOM_TARGET_FPR;
+    BloomAllocation bloomAllocation = BLOOM_ALLOCATION;
+    TunerMode tunerMode = TUNER_MODE;
+};
+
+// `knobsToString()`
+// Formats the knobs using the names accepted by the `k` command.
+std::string knobsToString(const Knobs& knobs) {
+    std::ostringstream ss;
+    ss << "page_size=" << knobs.pageSize << " buffer_pages=" << knobs.bufferPages << " file_pages=" << knobs.filePages
+       << " size_ratio=" << knobs.sizeRatio << " bloom_fpr=" << knobs.bloomTargetFpr
+       << " bloom_allocation=" << (knobs.bloomAllocation == BLOOM_MONKEY ? "monkey" : "uniform")
+       << " tuner=" << (knobs.tunerMode == TUNER_APPLY ? "apply" : knobs.tunerMode == TUNER_RECOMMEND ? "recommend" : "off");
+    return ss.str();
+}
+
+// `monkeyFpr()`
+// Returns the false positive rate of level l (1 <= l <= numLevels) under the Monkey allocation, which
+// minimizes the sum of the false positive rates for the memory of a uniform `targetFpr`. Level l holds
+// about sizeRatio^l entries, and the optimum makes each level's rate proportional to its size.
+double monkeyFpr(double targetFpr, size_t sizeRatio, size_t numLevels, size_t l) {
+    double logRatio = std::log(static_cast<double>(sizeRatio));
+    double weighted = 0, total = 0;
+    for (size_t i = 1; i <= numLevels; i++) {
+        double size = std::pow(static_cast<double>(sizeRatio), static_cast<double>(i));
+        weighted += size * (numLevels - i);
+        total += size;
+    }
+    // -ln of the last level's rate. Shallower levels get ln(sizeRatio) more per level above it.
+    double lastLevelBits = -std::log(targetFpr) - logRatio * weighted / total;
+    return std::min(1.0, std::exp(-(lastLevelBits + (numLevels - l) * logRatio)));
+}
+
+// `Workload`
+// The fraction of operations of each kind.
+struct Workload {
+    double writes = 0;
+    double emptyGets = 0;
+    double gets = 0;
+    double ranges = 0;
+};
+
+// `Tuner`
+// Estimates the operation mix from the session statistics and searches for the knobs minimizing the
+// expected I/Os per operation under a leveled LSM cost model, as in Monkey and Endure. For a tree of N
+// entries with B entries per page, a buffer of P entries, and size ratio T, there are
+// L = ceil(log_T(N / P)) levels and:
+//   - a write costs L * (T - 1) / B I/Os, amortized over the merges that move it down,
+//   - a get for a missing key costs the sum of the false positive rates of the levels,
+//   - a get for a present key costs one I/O plus the false positive rates of the levels above it,
+//   - a range costs one seek per level.
+// Candidates share the memory of the current buffer and bloom filters between the two.
+class Tuner {
+    private:
+        Workload mix;
+        // The counters at the last observation.
+        Stats seen;
+        bool observed = false;
+
+    public:
+        // `Tuner::observe()`
+        // Folds the operations since the last observation into the estimated mix.
+        void observe(const Stats& stats) {
+            double writes = (stats.puts + stats.adds + stats.deletes + stats.rangeDeletes)
+                          - static_cast<double>(this->seen.puts + this->seen.adds + this->seen.deletes + this->seen.rangeDeletes);
+            double emptyGets = static_cast<double>(stats.failedGets) - this->seen.failedGets;
+            double gets = static_cast<double>(stats.successfulGets) - this->seen.successfulGets;
+            double ranges = static_cast<double>(stats.ranges) - this->seen.ranges;
+            double total = writes + emptyGets + gets + ranges;
+            this->seen = stats;
+            if (total <= 0) return;
+
+            double decay = this->observed ? TUNER_DECAY : 0;
+            this->mix.writes = decay * this->mix.writes + (1 - decay) * writes / total;
+            this->mix.emptyGets = decay * this->mix.emptyGets + (1 - decay) * emptyGets / total;
+            this->mix.gets = decay * this->mix.gets + (1 - decay) * gets / total;
+            this->mix.ranges = decay * this->mix.ranges + (1 - decay) * ranges / total;
+            this->observed = true;
+        }
+
+        // `Tuner::cost()`
+        // Returns the modeled I/Os per operation of a tree of `numEntries` entries with the given knobs.
+        double cost(const Knobs& knobs, double numEntries) {
+            double entriesPerPage = knobs.pageSize;
+            double bufferEntries = knobs.bufferPages * entriesPerPage;
+            double sizeRatio = knobs.sizeRatio;
+            size_t numLevels = static_cast<size_t>(std::max(1.0, std::ceil(std::log(std::max(numEntries / bufferEntries, 1.0)) / std::log(sizeRatio))));
+
+            double emptyGet = 0, get = 1;
+            for (size_t l = 1; l <= numLevels; l++) {
+                double fpr = knobs.bloomAllocation == BLOOM_MONKEY ? monkeyFpr(knobs.bloomTargetFpr, knobs.sizeRatio, numLevels, l) : knobs.bloomTargetFpr;
+                emptyGet += fpr;
+                if (l < numLevels) get += fpr;
+            }
+            double write = numLevels * (sizeRatio - 1) / entriesPerPage;
+            double range = numLevels;
+            return this->mix.writes * write + this->mix.emptyGets * emptyGet + this->mix.gets * get + this->mix.ranges * range;
+        }
+
+        // `Tuner::recommend()`
+        // Returns the knobs with the lowest modeled cost that use no more memory for the buffer and bloom
+        // filters than the current knobs. The page size and file size are left alone.
+        Knobs recommend(const Knobs& knobs, double numEntries, size_t entryBytes) {
+            if (!this->observed || numEntries < knobs.bufferPages * knobs.pageSize) return knobs;
+
+            double log2Squared = std::pow(std::log(2), 2);
+            double memoryBits = knobs.bufferPages * knobs.pageSize * entryBytes * 8 - numEntries * std::log(knobs.bloomTargetFpr) / log2Squared;
+
+            Knobs best = knobs;
+            double bestCost = this->cost(knobs, numEntries);
+            for (size_t bufferPages = 1; bufferPages <= TUNER_MAX_BUFFER_PAGES; bufferPages *= 2) {
+                double filterBits = memoryBits - static_cast<double>(bufferPages * knobs.pageSize * entryBytes * 8);
+                if (filterBits <= 0) break;
+                double fpr = std::min(1.0, std::exp(-filterBits / numEntries * log2Squared));
+                for (size_t sizeRatio = 2; sizeRatio <= TUNER_MAX_SIZE_RATIO; sizeRatio++) {
+                    for (BloomAllocation allocation : {BLOOM_UNIFORM, BLOOM_MONKEY}) {
+                        Knobs candidate = knobs;
+                        candidate.bufferPages = bufferPages;
+                        candidate.sizeRatio = sizeRatio;
+                        candidate.bloomTargetFpr = fpr;
+                        candidate.bloomAllocation = allocation;
+                        double candidateCost = this->cost(candidate, numEntries);
+                        if (candidateCost < bestCost) {
+                            best = candidate;
+                            bestCost = candidateCost;
+                        }
+                    }
+                }
+            }
+            return best;
+        }
+
+        // `Tuner::step()`
+        // Returns the knobs moved one step from `current` towards `target`: the size ratio by one, the
+        // buffer by a factor of two, and the bloom filter settings all the way since they only apply to
+        // runs written from now on.
+        static Knobs step(const Knobs& current, const Knobs& target) {
+            Knobs next = current;
+            if (current.sizeRatio < target.sizeRatio) next.sizeRatio++;
+            else if (target.sizeRatio < current.sizeRatio) next.sizeRatio--;
+            if (current.bufferPages < target.bufferPages) next.bufferPages = std::min(current.bufferPages * 2, target.bufferPages);
+            else if (target.bufferPages < current.bufferPages) next.bufferPages = std::max(current.bufferPages / 2, target.bufferPages);
+            next.bloomTargetFpr = target.bloomTargetFpr;
+            next.bloomAllocation = target.bloomAllocation;
+            return next;
+        }
+
+        const Workload& getWorkload() { return this->mix; }
+};
+
+#endif
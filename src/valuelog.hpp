@@ -0,0 +1,262 @@
+#ifndef VALUELOG_HPP
+#define VALUELOG_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <string>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+#include <filesystem>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+
+// `ValueLog`
+// The values of a tree with VLOG encoding, kept apart from the keys as in WiscKey. Values are appended
+// once, as `[key][value]` records, to the head segment of the log, and the runs store an 8-byte pointer
+// to the record instead of the value: the segment id in the high bits and the offset in the low
+// `OFFSET_BITS`. Merges copy the pointers, so the values are never rewritten by compactions.
+//
+// Each segment is an mmap'd file, `vlog<id>.data`, starting with a header of three counters: the bytes
+// used, the records appended, and the records known to be dead because the tree dropped their
+// pointers. The log rolls over to a new segment once the head holds VLOG_SEGMENT_BYTES. Garbage
+// collection copies the live records of a sealed segment to the head, then deletes the segment file.
+template<typename KeyType, typename ValType>
+class ValueLog {
+    public:
+        // The pointer stored for tombstones, which have no value.
+        static constexpr uint64_t NO_VALUE = std::numeric_limits<uint64_t>::max();
+
+    private:
+        static constexpr size_t OFFSET_BITS = 40;
+        static constexpr size_t HEADER_BYTES = 3 * sizeof(uint64_t);
+
+        struct Segment {
+            char* data = nullptr;
+            size_t capacity = 0;
+
+            uint64_t& used() const { return reinterpret_cast<uint64_t*>(this->data)[0]; }
+            uint64_t& records() const { return reinterpret_cast<uint64_t*>(this->data)[1]; }
+            uint64_t& dead() const { return reinterpret_cast<uint64_t*>(this->data)[2]; }
+        };
+
+        std::string directory;
+        // Every segment by id. The last one is the head, which records are appended to.
+        std::map<uint64_t, Segment> segments;
+        // Guards the dead record counts, which merges running in parallel update.
+        std::mutex deadMutex;
+        size_t bytesAppended = 0;
+        size_t bytesRelocated = 0;
+        size_t segmentsCollected = 0;
+
+        std::string segmentFileName(uint64_t id) const {
+            return this->directory + "/vlog" + std::to_string(id) + ".data";
+        }
+
+        // `ValueLog::mapSegment()`
+        // Maps segment `id` with room for `capacity` bytes, creating its file if needed.
+        Segment& mapSegment(uint64_t id, size_t capacity) {
+            Segment& segment = this->segments[id];
+            if (segment.data != nullptr) munmap(segment.data, segment.capacity);
+            segment.capacity = capacity;
+            segment.data = mmapLevel<char>(this->segmentFileName(id).c_str(), capacity);
+            if (segment.used() < HEADER_BYTES) segment.used() = HEADER_BYTES;
+            return segment;
+        }
+
+        template<typename T>
+        static size_t encodedBytes(const T& value) {
+            if constexpr (std::is_same_v<T, std::string>) return sizeof(uint32_t) + value.size();
+            else return sizeof(T);
+        }
+
+        // `ValueLog::encodedBytesAt()`
+        // The bytes taken by the encoded value at `position`.
+        template<typename T>
+        static size_t encodedBytesAt(const char* position) {
+            if constexpr (std::is_same_v<T, std::string>) {
+                uint32_t size;
+                std::memcpy(&size, position, sizeof(size));
+                return sizeof(uint32_t) + size;
+            } else {
+                (void)position;
+                return sizeof(T);
+            }
+        }
+
+        template<typename T>
+        static void encode(char* position, const T& value) {
+            if constexpr (std::is_same_v<T, std::string>) {
+                uint32_t size = value.size();
+                std::memcpy(position, &size, sizeof(size));
+                std::memcpy(position + sizeof(size), value.data(), size);
+            } else {
+                std::memcpy(position, &value, sizeof(T));
+            }
+        }
+
+        template<typename T>
+        static T decode(const char* position) {
+            T value;
+            if constexpr (std::is_same_v<T, std::string>) {
+                uint32_t size;
+                std::memcpy(&size, position, sizeof(size));
+                value.assign(position + sizeof(size), size);
+            } else {
+                std::memcpy(&value, position, sizeof(T));
+            }
+            return value;
+        }
+
+        // `ValueLog::reserve()`
+        // Returns the pointer to `bytes` free bytes at the end of the head segment, rolling over to a new
+        // segment if the head is full and growing an empty head that is too small.
+        uint64_t reserve(size_t bytes) {
+            uint64_t id = this->segments.rbegin()->first;
+            Segment* head = &this->segments.rbegin()->second;
+            if (head->used() + bytes > head->capacity) {
+                if (head->records() > 0) {
+                    id++;
+                    head = &this->mapSegment(id, std::max(VLOG_SEGMENT_BYTES, HEADER_BYTES + bytes));
+                } else {
+                    head = &this->mapSegment(id, HEADER_BYTES + bytes);
+                }
+            }
+            uint64_t pointer = (id << OFFSET_BITS) | head->used();
+            head->used() += bytes;
+            head->records()++;
+            return pointer;
+        }
+
+        const char* record(uint64_t pointer) const {
+            auto it = this->segments.find(pointer >> OFFSET_BITS);
+            if (it == this->segments.end()) return nullptr;
+            return it->second.data + (pointer & ((static_cast<uint64_t>(1) << OFFSET_BITS) - 1));
+        }
+
+        size_t recordBytes(const char* position) const {
+            size_t keyBytes = encodedBytesAt<KeyType>(position);
+            return keyBytes + encodedBytesAt<ValType>(position + keyBytes);
+        }
+
+    public:
+        // `ValueLog::open()`
+        // Maps every segment in `directory`, or creates the first one.
+        void open(const std::string& directory) {
+            this->directory = directory;
+            for (const auto& file : std::filesystem::directory_iterator(directory)) {
+                std::string name = file.path().filename().string();
+                if (name.rfind("vlog", 0) != 0 || name.size() <= 9 || name.substr(name.size() - 5) != ".data") continue;
+                uint64_t id = std::stoull(name.substr(4, name.size() - 9));
+                this->mapSegment(id, std::filesystem::file_size(file.path()));
+            }
+            if (this->segments.empty()) this->mapSegment(0, VLOG_SEGMENT_BYTES);
+        }
+
+        void close() {
+            for (auto& [id, segment] : this->segments) munmap(segment.data, segment.capacity);
+            this->segments.clear();
+        }
+
+        // `ValueLog::append()`
+        // Appends a record for the value of `key` and returns its pointer.
+        uint64_t append(const KeyType& key, const ValType& val) {
+            size_t keyBytes = encodedBytes(key), bytes = keyBytes + encodedBytes(val);
+            uint64_t pointer = this->reserve(bytes);
+            char* position = const_cast<char*>(this->record(pointer));
+            encode(position, key);
+            encode(position + keyBytes, val);
+            this->bytesAppended += bytes;
+            return pointer;
+        }
+
+        // `ValueLog::read()`
+        // Returns the value a pointer refers to. Only shadowed versions of a key can point into a segment
+        // that has been collected; those read as `ValType()`.
+        ValType read(uint64_t pointer) const {
+            const char* position = pointer == NO_VALUE ? nullptr : this->record(pointer);
+            if (position == nullptr) return ValType();
+            return decode<ValType>(position + encodedBytesAt<KeyType>(position));
+        }
+
+        // `ValueLog::discard()`
+        // Records that the tree no longer holds `pointer`, so its record is garbage.
+        void discard(uint64_t pointer) {
+            if (pointer == NO_VALUE) return;
+            std::lock_guard<std::mutex> lock(this->deadMutex);
+            auto it = this->segments.find(pointer >> OFFSET_BITS);
+            if (it != this->segments.end()) it->second.dead()++;
+        }
+
+        // `ValueLog::pickGarbage()`
+        // Returns the sealed segment with the largest fraction of dead records, if that is at least `ratio`.
+        std::optional<uint64_t> pickGarbage(double ratio) const {
+            std::optional<uint64_t> best;
+            double bestRatio = ratio;
+            for (auto it = this->segments.begin(); std::next(it) != this->segments.end(); it++) {
+                const Segment& segment = it->second;
+                double deadRatio = segment.records() == 0 ? 1 : static_cast<double>(segment.dead()) / segment.records();
+                if (deadRatio >= bestRatio) {
+                    best = it->first;
+                    bestRatio = deadRatio;
+                }
+            }
+            return best;
+        }
+
+        // `ValueLog::forEachRecord()`
+        // Calls `visit(key, pointer)` for every record of segment `id`, oldest first.
+        template<typename Visit>
+        void forEachRecord(uint64_t id, Visit visit) const {
+            const Segment& segment = this->segments.at(id);
+            for (size_t offset = HEADER_BYTES; offset < segment.used(); offset += this->recordBytes(segment.data + offset)) {
+                visit(decode<KeyType>(segment.data + offset), (id << OFFSET_BITS) | offset);
+            }
+        }
+
+        // `ValueLog::relocate()`
+        // Copies the record `pointer` refers to onto the head segment and returns the new pointer.
+        uint64_t relocate(uint64_t pointer) {
+            size_t bytes = this->recordBytes(this->record(pointer));
+            uint64_t moved = this->reserve(bytes);
+            // Reserving may remap the head, so both records are looked up afterwards.
+            std::memcpy(const_cast<char*>(this->record(moved)), this->record(pointer), bytes);
+            this->bytesAppended += bytes;
+            this->bytesRelocated += bytes;
+            return moved;
+        }
+
+        // `ValueLog::drop()`
+        // Deletes segment `id`, whose live records have all been relocated.
+        void drop(uint64_t id) {
+            Segment& segment = this->segments.at(id);
+            munmap(segment.data, segment.capacity);
+            this->segments.erase(id);
+            std::filesystem::remove(this->segmentFileName(id));
+            this->segmentsCollected++;
+        }
+
+        // `ValueLog::bytes()`
+        // The bytes used by every segment, dead records included.
+        size_t bytes() const {
+            size_t used = 0;
+            for (const auto& [id, segment] : this->segments) used += segment.used();
+            return used;
+        }
+
+        size_t numSegments() const { return this->segments.size(); }
+        size_t getBytesAppended() const { return this->bytesAppended; }
+        size_t getBytesRelocated() const { return this->bytesRelocated; }
+        size_t getSegmentsCollected() const { return this->segmentsCollected; }
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef WORKLOAD_HPP
+#define WORKLOAD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <type_traits>
+
+// Helpers shared by `benchmark.cpp` and `ycsb.cpp`: latency percentiles, key and value generators, and
+// the key choosers used to skew a workload.
+
+// `Latencies`
+// Operation latencies in nanoseconds. Call `sort()` once all the samples are in.
+struct Latencies {
+    std::vector<double> samples;
+
+    void add(double latency) { this->samples.push_back(latency); }
+    void merge(const Latencies& other) { this->samples.insert(this->samples.end(), other.samples.begin(), other.samples.end()); }
+    void sort() { std::sort(this->samples.begin(), this->samples.end()); }
+    size_t count() const { return this->samples.size(); }
+
+    double percentile(double p) const {
+        if (this->samples.empty()) return 0;
+        size_t index = std::min(this->samples.size() - 1, static_cast<size_t>(p / 100 * this->samples.size()));
+        return this->samples[index];
+    }
+
+    double mean() const {
+        if (this->samples.empty()) return 0;
+        double sum = 0;
+        for (double latency : this->samples) sum += latency;
+        return sum / this->samples.size();
+    }
+};
+
+// `makeKey()`
+// Maps a number to a key. String keys are zero-padded so that they sort in numeric order.
+template<typename T>
+T makeKey(uint64_t i) {
+    if constexpr (std::is_same_v<T, std::string>) {
+        std::ostringstream ss;
+        ss << "key" << std::setw(12) << std::setfill('0') << i;
+        return ss.str();
+    } else {
+        return static_cast<T>(i);
+    }
+}
+
+template<typename T>
+T makeVal(uint64_t i) {
+    if constexpr (std::is_same_v<T, std::string>) return "val" + std::to_string(i);
+    else return static_cast<T>(i);
+}
+
+// `fnvHash()`
+// The 64-bit FNV-1a hash of a number, used to scatter popular items across the key space.
+uint64_t fnvHash(uint64_t value) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; i++) {
+        hash ^= value & 0xff;
+        hash *= 0x100000001b3ull;
+        value >>= 8;
+    }
+    return hash;
+}
+
+// `ZipfianChooser`
+// Picks items in [0, numItems) with item i chosen in proportion to 1 / (i + 1)^theta, using the
+// method of Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as YCSB does. With
+// `scrambled` set, the ranks are hashed so that the popular items are spread over the key space
+// instead of being the smallest keys.
+class ZipfianChooser {
+    private:
+        uint64_t numItems;
+        double theta, alpha, zetan, eta;
+        bool scrambled;
+
+        static double zeta(uint64_t n, double theta) {
+            double sum = 0;
+            for (uint64_t i = 1; i <= n; i++) sum += 1 / std::pow(static_cast<double>(i), theta);
+            return sum;
+        }
+
+    public:
+        ZipfianChooser(uint64_t numItems, double theta = 0.99, bool scrambled = true)
+            : numItems(std::max<uint64_t>(numItems, 1)), theta(theta), scrambled(scrambled) {
+            double zeta2 = zeta(2, theta);
+            this->alpha = 1 / (1 - theta);
+            this->zetan = zeta(this->numItems, theta);
+            this->eta = (1 - std::pow(2.0 / this->numItems, 1 - theta)) / (1 - zeta2 / this->zetan);
+        }
+
+        template<typename Rng>
+        uint64_t next(Rng& rng) const {
+            double u = std::uniform_real_distribution<double>(0, 1)(rng);
+            double uz = u * this->zetan;
+            uint64_t rank;
+            if (uz < 1) rank = 0;
+            else if (uz < 1 + std::pow(0.5, this->theta)) rank = 1;
+            else rank = static_cast<uint64_t>(this->numItems * std::pow(this->eta * u - this->eta + 1, this->alpha));
+            rank = std::min(rank, this->numItems - 1);
+            return this->scrambled ? fnvHash(rank) % this->numItems : rank;
+        }
+};
+
+// `KeyChooser`
+// Picks the item an operation reads or updates out of the `inserted` items written so far.
+//   - uniform: every item is equally likely.
+//   - zipfian: a few items are very popular, see `ZipfianChooser`.
+//   - latest: like zipfian, but the most recently inserted items are the most popular.
+//   - hotspot: `hotOpFraction` of the operations go to the first `hotSetFraction` of the items.
+class KeyChooser {
+    private:
+        std::string distribution;
+        const std::atomic<uint64_t>& inserted;
+        ZipfianChooser zipfian;
+        double hotSetFraction, hotOpFraction;
+
+    public:
+        KeyChooser(const std::string& distribution, const std::atomic<uint64_t>& inserted, uint64_t numItems,
+                   double hotSetFraction = 0.2, double hotOpFraction = 0.8)
+            : distribution(distribution), inserted(inserted), zipfian(numItems, 0.99, distribution == "zipfian"),
+              hotSetFraction(hotSetFraction), hotOpFraction(hotOpFraction) {}
+
+        static bool valid(const std::string& distribution) {
+            return distribution == "uniform" || distribution == "zipfian" || distribution == "latest" || distribution == "hotspot";
+        }
+
+        template<typename Rng>
+        uint64_t next(Rng& rng) const {
+            uint64_t numItems = std::max<uint64_t>(this->inserted.load(std::memory_order_relaxed), 1);
+            if (this->distribution == "zipfian") {
+                return this->zipfian.next(rng) % numItems;
+            } else if (this->distribution == "latest") {
+                return numItems - 1 - std::min(this->zipfian.next(rng), numItems - 1);
+            } else if (this->distribution == "hotspot") {
+                uint64_t hotItems = std::max<uint64_t>(1, static_cast<uint64_t>(numItems * this->hotSetFraction));
+                if (std::uniform_real_distribution<double>(0, 1)(rng) < this->hotOpFraction || hotItems == numItems) {
+                    return rng() % hotItems;
+                }
+                return hotItems + rng() % (numItems - hotItems);
+            }
+            return rng() % numItems;
+        }
+};
+
+#endif
@@ -0,0 +1,451 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cctype>
+#include <filesystem>
+#include <iomanip>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "Types.hpp"
+#include "Utils.hpp"
+#include "lsm.hpp"
+#include "sharded.hpp"
+#include "workload.hpp"
+
+// A YCSB-style load driver. Run `make ycsb`, then
+//
+//     ./ycsb [--workload a-f] [--records N] [--ops N] [--threads N] [--distribution uniform|zipfian|latest|hotspot]
+//            [--target OPS_PER_SEC] [--interval SECONDS] [--scan-length N] [--seed SEED] [--format csv|json]
+//            [--server HOST:PORT] [--skip-load]
+//
+// It loads `records` items, then runs `ops` operations of the workload on `threads` threads, either
+// against a tree embedded in the process (in `ycsb_data`, wiped at the end) or against a server started
+// with `./server --listen`. With `--target` the driver runs open loop: operations are issued on a fixed
+// schedule and their latency is measured from when they were due, so a stalled tree is not hidden by
+// the driver slowing down. Without it every thread issues its next operation as soon as the last one
+// returns. The throughput and latency percentiles are reported every `interval` seconds and per
+// operation type at the end.
+
+// `Operation`
+// The operations of the YCSB core workloads.
+enum Operation {
+    OP_READ,
+    OP_UPDATE,
+    OP_INSERT,
+    OP_SCAN,
+    OP_READ_MODIFY_WRITE,
+    NUM_OPERATIONS
+};
+
+const char* OPERATION_NAMES[NUM_OPERATIONS] = {"READ", "UPDATE", "INSERT", "SCAN", "READ_MODIFY_WRITE"};
+
+// `WorkloadMix`
+// The fraction of each operation in a workload, and the distribution its keys are chosen from.
+struct WorkloadMix {
+    double fractions[NUM_OPERATIONS];
+    std::string distribution;
+};
+
+// `coreWorkload()`
+// Returns the mix of YCSB core workload a-f:
+//   a: update heavy, 50% reads and 50% updates.
+//   b: read mostly, 95% reads and 5% updates.
+//   c: read only.
+//   d: read latest, 95% reads and 5% inserts, skewed to the newest items.
+//   e: short ranges, 95% scans and 5% inserts.
+//   f: read-modify-write, 50% reads and 50% read-modify-writes.
+bool coreWorkload(char workload, WorkloadMix& mix) {
+    switch (workload) {
+        case 'a': mix = {{0.5, 0.5, 0, 0, 0}, "zipfian"}; return true;
+        case 'b': mix = {{0.95, 0.05, 0, 0, 0}, "zipfian"}; return true;
+        case 'c': mix = {{1, 0, 0, 0, 0}, "zipfian"}; return true;
+        case 'd': mix = {{0.95, 0, 0.05, 0, 0}, "latest"}; return true;
+        case 'e': mix = {{0, 0, 0.05, 0.95, 0}, "zipfian"}; return true;
+        case 'f': mix = {{0.5, 0, 0, 0, 0.5}, "zipfian"}; return true;
+        default: return false;
+    }
+}
+
+struct YcsbOptions {
+    char workload = 'a';
+    uint64_t records = 100000;
+    uint64_t ops = 1000000;
+    size_t threads = 1;
+    std::string distribution;
+    double target = 0;
+    double interval = 1;
+    uint64_t scanLength = 100;
+    uint64_t seed = 42;
+    std::string format = "csv";
+    std::string server;
+    bool skipLoad = false;
+};
+
+// `EmbeddedTarget`
+// Runs operations directly on a tree in this process. A tree that is not thread safe is locked for
+// each operation.
+template<typename Tree>
+class EmbeddedTarget {
+    private:
+        Tree& tree;
+        std::mutex& treeMutex;
+
+        std::unique_lock<std::mutex> lock() {
+            std::unique_lock<std::mutex> lock(this->treeMutex, std::defer_lock);
+            if (!Tree::threadSafe) lock.lock();
+            return lock;
+        }
+
+    public:
+        EmbeddedTarget(Tree& tree, std::mutex& treeMutex) : tree(tree), treeMutex(treeMutex) {}
+
+        bool connected() { return true; }
+
+        void put(uint64_t item, uint64_t value) {
+            std::unique_lock<std::mutex> lock = this->lock();
+            this->tree.put(SUCCESS, makeKey<KEY_TYPE>(item), makeVal<VAL_TYPE>(value), false);
+        }
+
+        std::string get(uint64_t item) {
+            std::unique_lock<std::mutex> lock = this->lock();
+            return std::get<1>(this->tree.get(SUCCESS, makeKey<KEY_TYPE>(item)));
+        }
+
+        std::string scan(uint64_t item, uint64_t length) {
+            std::unique_lock<std::mutex> lock = this->lock();
+            return std::get<1>(this->tree.range(SUCCESS, makeKey<KEY_TYPE>(item), makeKey<KEY_TYPE>(item + length)));
+        }
+};
+
+// `ServerTarget`
+// Sends operations to a server started with `./server --listen` over its own connection, and waits
+// for each reply line.
+class ServerTarget {
+    private:
+        int fd = -1;
+        std::string pending;
+
+        std::string request(const std::string& command) {
+            std::string line = command + "\n";
+            if (send(this->fd, line.data(), line.size(), MSG_NOSIGNAL) < 0) return "";
+            size_t newline;
+            char buffer[4096];
+            while ((newline = this->pending.find('\n')) == std::string::npos) {
+                ssize_t received = recv(this->fd, buffer, sizeof(buffer), 0);
+                if (received <= 0) return "";
+                this->pending.append(buffer, received);
+            }
+            std::string reply = this->pending.substr(0, newline);
+            this->pending.erase(0, newline + 1);
+            return reply;
+        }
+
+    public:
+        ServerTarget(const std::string& server) {
+            size_t colon = server.rfind(':');
+            std::string host = colon == std::string::npos ? server : server.substr(0, colon);
+            std::string port = colon == std::string::npos ? std::to_string(PORT) : server.substr(colon + 1);
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* addresses;
+            if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) return;
+            for (addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
+                this->fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+                if (this->fd < 0) continue;
+                if (connect(this->fd, address->ai_addr, address->ai_addrlen) == 0) break;
+                close(this->fd);
+                this->fd = -1;
+            }
+            freeaddrinfo(addresses);
+        }
+
+        ServerTarget(const ServerTarget&) = delete;
+
+        ~ServerTarget() {
+            if (this->fd >= 0) close(this->fd);
+        }
+
+        bool connected() { return this->fd >= 0; }
+
+        void put(uint64_t item, uint64_t value) {
+            this->request("p " + valueToString(makeKey<KEY_TYPE>(item)) + " " + valueToString(makeVal<VAL_TYPE>(value)));
+        }
+
+        std::string get(uint64_t item) {
+            return this->request("g " + valueToString(makeKey<KEY_TYPE>(item)));
+        }
+
+        std::string scan(uint64_t item, uint64_t length) {
+            return this->request("r " + valueToString(makeKey<KEY_TYPE>(item)) + " " + valueToString(makeKey<KEY_TYPE>(item + length)));
+        }
+};
+
+// `ThreadLatencies`
+// The latencies recorded by one client thread: those of the current reporting interval, and those of
+// the whole run per operation.
+struct ThreadLatencies {
+    std::mutex mutex;
+    Latencies interval;
+    Latencies total[NUM_OPERATIONS];
+};
+
+// `Driver`
+// Loads the items and runs the workload, creating one `Target` per client thread with `connect`.
+template<typename Target, typename Connect>
+class Driver {
+    private:
+        YcsbOptions options;
+        WorkloadMix mix;
+        Connect connect;
+        std::ostream& out;
+        // The number of items written so far, which bounds the items reads can pick.
+        std::atomic<uint64_t> inserted{0};
+        std::atomic<uint64_t> nextOp{0};
+        std::atomic<size_t> running{0};
+        std::vector<std::unique_ptr<ThreadLatencies>> latencies;
+        std::chrono::steady_clock::time_point start;
+
+        // `Driver::row()`
+        // Writes one line of results as CSV or as a JSON object.
+        void row(const std::string& kind, const std::string& name, double seconds, double opsPerSec, const Latencies& latencies) {
+            if (this->options.format == "json") {
+                this->out << "{\"kind\": \"" << kind << "\", \"name\": \"" << name << "\", \"time_s\": " << seconds
+                          << ", \"ops\": " << latencies.count() << ", \"ops_per_sec\": " << opsPerSec
+                          << ", \"mean_ns\": " << latencies.mean() << ", \"p50_ns\": " << latencies.percentile(50)
+                          << ", \"p90_ns\": " << latencies.percentile(90) << ", \"p99_ns\": " << latencies.percentile(99)
+                          << ", \"p999_ns\": " << latencies.percentile(99.9) << ", \"max_ns\": " << latencies.percentile(100) << "}" << std::endl;
+            } else {
+                this->out << kind << "," << name << "," << seconds << "," << latencies.count() << "," << opsPerSec << ","
+                          << latencies.mean() << "," << latencies.percentile(50) << "," << latencies.percentile(90) << ","
+                          << latencies.percentile(99) << "," << latencies.percentile(99.9) << "," << latencies.percentile(100) << std::endl;
+            }
+        }
+
+        double elapsed() {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start).count();
+        }
+
+        // `Driver::load()`
+        // Inserts the first `records` items, split across the threads.
+        void load() {
+            std::vector<std::thread> threads;
+            std::vector<Latencies> loadLatencies(this->options.threads);
+            auto loadStart = std::chrono::steady_clock::now();
+            for (size_t t = 0; t < this->options.threads; t++) {
+                threads.emplace_back([this, t, &loadLatencies] {
+                    Target target = this->connect();
+                    for (uint64_t item = t; item < this->options.records; item += this->options.threads) {
+                        auto opStart = std::chrono::steady_clock::now();
+                        target.put(item, item);
+                        loadLatencies[t].add(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - opStart).count());
+                    }
+                });
+            }
+            for (std::thread& thread : threads) thread.join();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+            Latencies all;
+            for (const Latencies& thread : loadLatencies) all.merge(thread);
+            all.sort();
+            this->row("load", "INSERT", seconds, seconds > 0 ? all.count() / seconds : 0, all);
+        }
+
+        // `Driver::client()`
+        // Runs operations until `ops` of them have been issued across all the threads.
+        void client(size_t t) {
+            Target target = this->connect();
+            const KeyChooser& chooser = *this->chooser;
+            std::mt19937_64 rng(this->options.seed + t);
+            std::uniform_real_distribution<double> coin(0, 1);
+            ThreadLatencies& recorded = *this->latencies[t];
+
+            uint64_t op;
+            while ((op = this->nextOp.fetch_add(1)) < this->options.ops) {
+                std::chrono::steady_clock::time_point opStart = std::chrono::steady_clock::now();
+                if (this->options.target > 0) {
+                    opStart = this->start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(op / this->options.target));
+                    std::this_thread::sleep_until(opStart);
+                }
+
+                double x = coin(rng);
+                size_t kind = 0;
+                while (kind + 1 < NUM_OPERATIONS && x >= this->mix.fractions[kind]) x -= this->mix.fractions[kind++];
+                switch (kind) {
+                    case OP_READ: target.get(chooser.next(rng)); break;
+                    case OP_UPDATE: target.put(chooser.next(rng), rng()); break;
+                    case OP_INSERT: {
+                        uint64_t item = this->inserted.fetch_add(1);
+                        target.put(item, item);
+                        break;
+                    }
+                    case OP_SCAN: target.scan(chooser.next(rng), 1 + rng() % this->options.scanLength); break;
+                    case OP_READ_MODIFY_WRITE: {
+                        uint64_t item = chooser.next(rng);
+                        target.get(item);
+                        target.put(item, rng());
+                        break;
+                    }
+                }
+
+                double latency = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - opStart).count();
+                std::lock_guard<std::mutex> lock(recorded.mutex);
+                recorded.interval.add(latency);
+                recorded.total[kind].add(latency);
+            }
+            this->running--;
+        }
+
+        // `Driver::report()`
+        // Reports the operations completed since the last report. The final report is skipped if it
+        // would be empty.
+        void report(double& last, bool final = false) {
+            Latencies interval;
+            for (std::unique_ptr<ThreadLatencies>& recorded : this->latencies) {
+                std::lock_guard<std::mutex> lock(recorded->mutex);
+                interval.merge(recorded->interval);
+                recorded->interval.samples.clear();
+            }
+            if (final && interval.count() == 0) return;
+            interval.sort();
+            double now = this->elapsed();
+            this->row("interval", "ALL", now, now > last ? interval.count() / (now - last) : 0, interval);
+            last = now;
+        }
+
+        std::unique_ptr<KeyChooser> chooser;
+
+    public:
+        Driver(const YcsbOptions& options, const WorkloadMix& mix, Connect connect, std::ostream& out)
+            : options(options), mix(mix), connect(connect), out(out) {}
+
+        void run() {
+            if (this->options.format == "csv") {
+                this->out << "kind,name,time_s,ops,ops_per_sec,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << std::endl;
+            }
+            this->out << std::fixed << std::setprecision(1);
+            if (!this->options.skipLoad) this->load();
+            this->inserted = this->options.records;
+
+            // Inserts can grow the item count by up to `ops`, which bounds the items a zipfian chooser
+            // ranks.
+            uint64_t maxItems = this->options.records + static_cast<uint64_t>(this->options.ops * this->mix.fractions[OP_INSERT]) + 1;
+            std::string distribution = this->options.distribution.empty() ? this->mix.distribution : this->options.distribution;
+            this->chooser = std::make_unique<KeyChooser>(distribution, this->inserted, maxItems);
+
+            for (size_t t = 0; t < this->options.threads; t++) this->latencies.push_back(std::make_unique<ThreadLatencies>());
+            this->running = this->options.threads;
+            this->start = std::chrono::steady_clock::now();
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < this->options.threads; t++) threads.emplace_back(&Driver::client, this, t);
+
+            double last = 0;
+            while (this->running > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                if (this->elapsed() >= last + this->options.interval) this->report(last);
+            }
+            for (std::thread& thread : threads) thread.join();
+            this->report(last, true);
+
+            double seconds = this->elapsed();
+            Latencies all;
+            for (size_t kind = 0; kind < NUM_OPERATIONS; kind++) {
+                Latencies operation;
+                for (std::unique_ptr<ThreadLatencies>& recorded : this->latencies) operation.merge(recorded->total[kind]);
+                if (operation.count() == 0) continue;
+                all.merge(operation);
+                operation.sort();
+                this->row("summary", OPERATION_NAMES[kind], seconds, operation.count() / seconds, operation);
+            }
+            all.sort();
+            this->row("summary", "ALL", seconds, all.count() / seconds, all);
+        }
+};
+
+// `runEmbedded()`
+// Runs the workload against a tree in the `ycsb_data` folder, then wipes it.
+template<typename Tree>
+void runEmbedded(const YcsbOptions& options, const WorkloadMix& mix, std::ostream& out) {
+    std::filesystem::remove_all("ycsb_data");
+    Tree tree("ycsb_data");
+    std::mutex treeMutex;
+    auto connect = [&tree, &treeMutex] { return EmbeddedTarget<Tree>(tree, treeMutex); };
+    Driver<EmbeddedTarget<Tree>, decltype(connect)> driver(options, mix, connect, out);
+    driver.run();
+    tree.shutdownServer("sw");
+}
+
+// `main()`
+// Parses the options and runs the workload. The tree's own output is silenced so that only the results
+// are printed.
+int main(int argc, char** argv) {
+    YcsbOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--skip-load") {
+            options.skipLoad = true;
+            continue;
+        }
+        if (i + 1 == argc) {
+            std::cerr << "Missing value for " << flag << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (flag == "--workload") options.workload = value.empty() ? ' ' : std::tolower(value[0]);
+        else if (flag == "--records") options.records = std::stoull(value);
+        else if (flag == "--ops") options.ops = std::stoull(value);
+        else if (flag == "--threads") options.threads = std::max<size_t>(1, std::stoull(value));
+        else if (flag == "--distribution") options.distribution = value;
+        else if (flag == "--target") options.target = std::stod(value);
+        else if (flag == "--interval") options.interval = std::stod(value);
+        else if (flag == "--scan-length") options.scanLength = std::max<uint64_t>(1, std::stoull(value));
+        else if (flag == "--seed") options.seed = std::stoull(value);
+        else if (flag == "--format") options.format = value;
+        else if (flag == "--server") options.server = value;
+        else {
+            std::cerr << "Unknown option: " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    WorkloadMix mix;
+    if (!coreWorkload(options.workload, mix)) {
+        std::cerr << "Unknown workload: " << options.workload << std::endl;
+        return 1;
+    }
+    if (!options.distribution.empty() && !KeyChooser::valid(options.distribution)) {
+        std::cerr << "Unknown distribution: " << options.distribution << std::endl;
+        return 1;
+    }
+
+    if (!options.server.empty()) {
+        if (!ServerTarget(options.server).connected()) {
+            std::cerr << "Failed to connect to " << options.server << std::endl;
+            return 1;
+        }
+        auto connect = [&options] { return ServerTarget(options.server); };
+        Driver<ServerTarget, decltype(connect)> driver(options, mix, connect, std::cout);
+        driver.run();
+        return 0;
+    }
+
+    // The results go to a second handle on stdout, and stdout itself is pointed at /dev/null. Unlike
+    // swapping the buffer of `std::cout`, this keeps the tree's own writes to `std::cout` thread safe.
+    std::ofstream out("/dev/stdout", std::ios::app);
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    close(devNull);
+    if (NUM_SHARDS == 1) runEmbedded<LSM<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE>>(options, mix, out);
+    else runEmbedded<ShardedLSM<KEY_TYPE, VAL_TYPE, DICT_VAL_TYPE>>(options, mix, out);
+    return 0;
+}